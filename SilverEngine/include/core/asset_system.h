@@ -117,6 +117,7 @@ namespace sv {
 
     // Load the asset if exists and use the extension to determine how this file should be treated
     // If it is in use simply get the existing asset
+	// With KeepItLoading the asset is returned in loading state and the file is loaded in a worker thread
     SV_API bool load_asset_from_file(AssetPtr& asset_ptr, const char* filepath, AssetLoadingPriority priority = AssetLoadingPriority_KeepItLoading);
 
 	SV_API bool        set_asset_name(AssetPtr& asset_ptr, const char* name);
@@ -124,7 +125,10 @@ namespace sv {
 
     SV_API void unload_asset(AssetPtr& asset_ptr);
 
+    // Returns NULL while the asset is loading or if the loading failed
     SV_API void* get_asset_content(const AssetPtr& asset_ptr);
+	SV_API bool  asset_is_loaded(const AssetPtr& asset_ptr);
+	SV_API bool  asset_is_loading(const AssetPtr& asset_ptr);
     SV_API const char* get_asset_filepath(const AssetPtr& asset_ptr);
 	SV_API const char* get_asset_type(const AssetPtr& asset_ptr);
 	SV_API bool is_asset_created_from_name(const AssetPtr& asset_ptr);
@@ -134,6 +138,13 @@ namespace sv {
     typedef bool(*AssetReloadFileFn)(void* asset, const char* name, const char* filepath);
     typedef bool(*AssetFreeFn)(void* asset, const char* name);
 
+	// Staged loading: the file is read and decoded in worker threads and uploaded in the main thread
+	typedef void*(*AssetDecodeFn)(const char* filepath, const u8* data, size_t size); // Returns NULL if fails
+	typedef bool(*AssetUploadFn)(void* asset, const char* name, void* decoded);
+	typedef void(*AssetFreeDecodedFn)(void* decoded);
+	// Memory owned by the asset apart from the asset struct
+	typedef void(*AssetMemoryFn)(void* asset, size_t* cpu_bytes, size_t* gpu_bytes);
+
     struct AssetTypeDesc {
 	
 		const char*	      name;
@@ -146,13 +157,59 @@ namespace sv {
 		AssetFreeFn	      free_fn;
 		f32		          unused_time;
 
+		// Optional, if defined are used instead of the load_file_fn. Without them the load_file_fn is called from the worker
+		// threads when the asset is loaded with KeepItLoading, so the types that create GPU resources have to define them
+		AssetDecodeFn      decode_fn = NULL;
+		AssetUploadFn      upload_fn = NULL;
+		AssetFreeDecodedFn free_decoded_fn = NULL;
+
+		AssetMemoryFn      memory_fn = NULL;
+
     };
 
     SV_API bool register_asset_type(const AssetTypeDesc* desc);
 
+	// Accumulated times in milliseconds
+	struct AssetLoadStats {
+		char name[ASSET_TYPE_NAME_SIZE + 1u];
+		u32  load_count;
+		f64  read_time;
+		f64  decode_time;
+		f64  upload_time;
+		f64  load_time; // Types without staged loading
+	};
+
+	SV_API void get_asset_load_stats(List<AssetLoadStats>& stats);
+
+	// Memory budgets in bytes, 0 means no limit. When a budget is exceeded the unreferenced assets
+	// are freed (the least recently used first) without waiting for the unused time
+	SV_API bool set_asset_budget(const char* type, u64 cpu_bytes, u64 gpu_bytes);
+	SV_API void set_asset_global_budget(u64 cpu_bytes, u64 gpu_bytes);
+
+	struct AssetMemoryStats {
+		char name[ASSET_TYPE_NAME_SIZE + 1u];
+		u32  asset_count;
+		u64  cpu_bytes;
+		u64  gpu_bytes;
+		u64  cpu_budget;
+		u64  gpu_budget;
+	};
+
+	// Resident memory of the loaded assets per type, the total includes the global budget
+	SV_API void get_asset_memory_stats(List<AssetMemoryStats>& stats, AssetMemoryStats* total = NULL);
+
     SV_API void update_asset_files();
     SV_API void free_unused_assets();
 
+	// Preload manifests: the file assets serialized between begin and end are saved in the manifest,
+	// including the assets loaded by them (the textures of a material). Can be nested
+	SV_API void asset_manifest_begin();
+	SV_API bool asset_manifest_end(const char* filepath);
+	SV_API void _asset_manifest_add(const AssetPtr& asset_ptr);
+
+	// Loads all the assets of the manifest in the worker threads, the list keeps the references
+	SV_API bool load_asset_manifest(const char* filepath, List<AssetPtr>& assets);
+
     SV_INLINE void serialize_asset(Serializer& s, const AssetPtr& asset_ptr)
     {
 		constexpr u32 VERSION = 1u;
@@ -171,6 +228,8 @@ namespace sv {
 			if (filepath != NULL) type = 1u;
 			if (is_asset_created_from_name(asset_ptr)) type = 2u;
 
+			if (type == 1u) _asset_manifest_add(asset_ptr);
+
 			serialize_u32(s, type);
 
 			switch (type) {
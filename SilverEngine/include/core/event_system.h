@@ -14,6 +14,7 @@ namespace sv {
     bool _event_initialize();
     bool _event_close();
 	void _event_update();
+	void _event_dispatch_posted();
 
 	bool register_plugin(const char* name, const char* filepath);
 	void unregister_plugins();
@@ -32,13 +33,51 @@ namespace sv {
 	SV_API bool get_plugin_by_name(const char* name, Library* library);
 
     typedef void(*EventFn)(void* event_data, void* register_data);
+	// Receives an array with the events of the same type
+	typedef void(*EventBatchFn)(void* events, u32 count, void* register_data);
 
     SV_API bool _event_register(const char* event_name, EventFn event, u32 flags, void* data, u32 data_size);
+    SV_API bool _event_register_batch(const char* event_name, EventBatchFn event, u32 flags, void* data, u32 data_size);
     SV_API bool _event_unregister(const char* event_name, EventFn event);
     SV_API void event_unregister_all(const char* event_name);
     
     SV_API void event_dispatch(const char* event_name, void* data);
 
+	// Resolved event type, avoids the name lookup and the locks in each dispatch. Valid while the event system is alive
+	struct EventType;
+	typedef EventType* EventHandle;
+
+	SV_API EventHandle event_handle(const char* event_name);
+	SV_API void        event_dispatch(EventHandle handle, void* data);
+
+	// Copies the event to the buffer of the current thread without locks (the threads not created by the task system share a buffer
+	// protected by a spin lock), the posted events are delivered after the scene update.
+	// All the posts of an event must have the same size. The batch listeners receive all the events of the frame in one call
+	SV_API bool event_post(EventHandle handle, const void* data, u32 size);
+
+#if SV_EDITOR
+
+	struct EventListenerProfile {
+		void* function;
+		char plugin[PLUGIN_NAME_SIZE + 1u]; // Empty if isn't a plugin function
+		u32 calls;
+		f64 time; // Milliseconds
+	};
+
+	struct EventProfile {
+		char name[EVENT_NAME_SIZE + 1u];
+		u32 calls;
+		f64 time; // Milliseconds
+		List<EventListenerProfile> listeners;
+	};
+
+	// Counts the calls and the time of each event and listener. The profile contains the stats of the last frame sorted by time
+	SV_API void event_profiling_enable(bool enable);
+	SV_API bool event_profiling_enabled();
+	SV_API void event_profile_get(List<EventProfile>& profiles);
+
+#endif
+
     template<typename T>
     SV_INLINE bool event_register(const char* event_name, T event, u32 flags, void* data, u32 data_size)
     {
@@ -56,5 +95,17 @@ namespace sv {
     {
 		return event_register(event_name, event, flags, nullptr, 0u);
     }
+
+    template<typename T>
+    SV_INLINE bool event_register_batch(const char* event_name, T event, u32 flags = 0u, void* data = nullptr, u32 data_size = 0u)
+    {
+		return _event_register_batch(event_name, (EventBatchFn) event, flags, data, data_size);
+    }
+
+	template<typename T>
+	SV_INLINE bool event_post(EventHandle handle, const T& event)
+	{
+		return event_post(handle, &event, sizeof(T));
+	}
     
 }
@@ -136,7 +136,8 @@ namespace sv {
 	SV_API bool save_mesh(const Mesh& mesh, const char* filepath);
     SV_API bool save_material(const Material& material, const char* filepath);
 
-    SV_API bool load_mesh(Mesh& mesh, const char* filepath);
+    // The data of the file can be passed if it's already read, the filepath is used to find the material
+    SV_API bool load_mesh(Mesh& mesh, const char* filepath, const u8* data = NULL, size_t size = 0u);
     SV_API bool load_material(Material& material, const char* filepath);
 
 }
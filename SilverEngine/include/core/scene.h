@@ -3,6 +3,8 @@
 #include "platform/graphics.h"
 #include "core/mesh.h"
 
+#include <initializer_list>
+
 namespace sv {
 
 	// TODO: Move on
@@ -11,6 +13,7 @@ namespace sv {
 	constexpr u32 SCENE_NAME_SIZE = 50u;
 
 	constexpr u32 COMPONENT_MAX = 64u;
+	constexpr u32 COMPONENT_REMOVAL_FRAMES = 120u;
 	constexpr u32 TAG_MAX = 64u;
 
 	constexpr u32 PREFAB_MAX = 256u;
@@ -28,6 +31,16 @@ namespace sv {
     typedef u32 Entity;
 	typedef u32 Tag;
 
+	// Entity with the generation of its slot. The generation changes every time the entity is destroyed,
+	// so a handle of a destroyed entity is detected in O(1) even if the slot is reused
+	struct EntityHandle {
+		Entity entity = 0;
+		u32    generation = 0u;
+
+		SV_INLINE bool operator==(const EntityHandle& other) const { return entity == other.entity && generation == other.generation; }
+		SV_INLINE bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+	};
+
     struct CameraComponent;
 
     struct SceneData {
@@ -55,11 +68,26 @@ namespace sv {
 
     SV_API SceneData* get_scene_data();
 
+    // The scene is changed when the preloaded assets are ready
     SV_API bool set_scene(const char* name);
     SV_API bool save_scene();
     SV_API bool save_scene(const char* filepath);
     SV_API bool clear_scene();
 
+	// Loads in parallel the assets listed in the preload manifest of the scene (generated when the scene is saved)
+	SV_API bool scene_preload(const char* name);
+	SV_API bool scene_preload_finished();
+
+	// In memory copy of the current scene. The entity arrays, the component pools and the archetypes are copied as they are,
+	// the components registered with ComponentRegisterFlag_Snapshot are copied and the others are stored with the serialize functions
+	// to fix the asset references and the external resources. The generations of the entities are increased where they differ,
+	// so the handles of the replaced entities aren't valid. The snapshot only can be restored in the same scene
+	struct SceneSnapshot;
+
+	SV_API SceneSnapshot* scene_snapshot_take();
+	SV_API bool           scene_snapshot_restore(SceneSnapshot* snapshot);
+	SV_API void           scene_snapshot_free(SceneSnapshot* snapshot);
+
     SV_API const char* get_scene_name();
     SV_API bool there_is_scene();
 
@@ -70,6 +98,7 @@ namespace sv {
     void _draw_scene(CameraComponent& camera, v3_f32 position, v4_f32 rotation);
 	void _draw_scene();
     bool _start_scene(const char* name);
+    bool _start_scene(const char* name, const char* filepath);
 
     SV_API bool create_entity_model(Entity parent, const char* filepath);
 
@@ -101,15 +130,27 @@ namespace sv {
 
 	SV_API Entity create_entity(Entity parent = 0, const char* name = NULL, Entity prefab = 0);
 	SV_API void   destroy_entity(Entity entity);
+
+	// The batched versions reserve the memory once. Both versions dispatch a single 'on_entities_create' / 'on_entities_destroy'
+	// event followed by the 'on_entity_create' / 'on_entity_destroy' event of each entity
+	SV_API bool create_entities(u32 count, Entity parent, Entity prefab, Entity* entities);
+	SV_API void destroy_entities(const Entity* entities, u32 count);
+	// The create and destroy events aren't dispatched while are suspended. Used by the tools that create temporary entities,
+	// the entities have to be destroyed before resuming the events
+	SV_API void suspend_entity_events(bool suspend);
 	SV_API Entity duplicate_entity(Entity entity);
 
 	SV_API bool        entity_exists(Entity entity);
+	SV_API bool        entity_exists(EntityHandle handle);
+	SV_API EntityHandle get_entity_handle(Entity entity);
+	SV_API Entity      get_handle_entity(EntityHandle handle); // Returns 0 if the entity was destroyed
 	SV_API const char* get_entity_name(Entity entity);
 	SV_API u64         get_entity_flags(Entity entity);
 	SV_API void	       set_entity_name(Entity entity, const char* name);
     SV_API u32	       get_entity_childs_count(Entity parent);
     SV_API Entity	   get_entity_child(Entity parent, u32 index);
     SV_API Entity      get_entity_parent(Entity entity);
+	SV_API bool        set_entity_parent(Entity entity, Entity parent); // The entity is added as the last child of the parent
     SV_API u32	       get_entity_component_count(Entity entity);
 	SV_API CompRef     get_entity_component_by_index(Entity entity, u32 index);
     SV_API u32	       get_entity_count();
@@ -118,9 +159,27 @@ namespace sv {
 	// TODO: Thats dangerous
 	SV_API void       set_entity_flags(Entity entity, u64 flags);
 	SV_API bool       has_entity_component(Entity entity, CompID comp_id);
+	// The pointers of the pool components are stable. The components registered with ComponentRegisterFlag_Archetype are moved
+	// when a component of the entity is added or removed, and the ComponentRegisterFlag_Compact ones when another component of
+	// the type is removed. Adding or removing those components inside a foreach_component can skip or repeat entities, use the defer functions
 	SV_API Component* add_entity_component(Entity entity, CompID comp_id);
 	SV_API void       remove_entity_component(Entity entity, CompID comp_id);
 	SV_API Component* get_entity_component(Entity entity, CompID comp_id);
+	// Returns the component to modify it, the change is notified to the changed iterators
+	SV_API Component* get_entity_component_mut(Entity entity, CompID comp_id);
+	SV_API void       mark_component_changed(Entity entity, CompID comp_id);
+	// Entities that lost the component (removed or destroyed) since the frame, included. The removals of the last COMPONENT_REMOVAL_FRAMES are kept
+	SV_API void       get_removed_components(CompID comp_id, u64 frame, List<Entity>& entities);
+
+	// Deferred structural changes. They are recorded in a buffer per thread and executed at the end of the scene update,
+	// so they are safe while iterating components or from the tasks. The deferred entity returned by
+	// defer_create_entity is only valid in other deferred commands. Only the main thread and the task system threads can use them
+	SV_API Entity defer_create_entity(Entity parent = 0, const char* name = NULL, Entity prefab = 0);
+	SV_API void   defer_destroy_entity(Entity entity);
+	SV_API void   defer_add_component(Entity entity, CompID comp_id);
+	SV_API void   defer_remove_component(Entity entity, CompID comp_id);
+	SV_API void   defer_set_component(Entity entity, CompID comp_id, const Component* src); // Adds the component if needed
+	SV_API void   play_entity_commands();
 
 	SV_API bool has_entity_tag(Entity entity, Tag tag);
 	SV_API void add_entity_tag(Entity entity, Tag tag);
@@ -137,6 +196,8 @@ namespace sv {
 	SV_API bool        is_prefab(Entity entity);
 	SV_API bool        is_mirror(Entity entity);
 	SV_API Entity      get_entity_mirror(Entity entity, u32 index);
+	// The transform setters of a mirror only modify the instance, this removes the override
+	SV_API void        reset_mirror_transform(Entity mirror);
 
 	// Iterators
 	
@@ -147,6 +208,7 @@ namespace sv {
 		u32 prefab_index;
 		CompID comp_id;
 		u32 pool_index;
+		u32 archetype_row;
 		Component* comp;
 		Entity entity;
 		bool has_next;
@@ -154,6 +216,7 @@ namespace sv {
 
 	enum CompItFlag : u32 {
 		CompItFlag_Once = SV_BIT(0),
+		CompItFlag_Write = SV_BIT(1), // The iterated components are marked as changed
 	};
 	
 	SV_API CompIt comp_it_begin(CompID comp_id, u32 flags = 0u);
@@ -171,6 +234,65 @@ namespace sv {
 	SV_API TagIt tag_it_begin(Tag tag);
 	SV_API void tag_it_next(TagIt& tag_it);
 
+	// Iterates the entities that have all the tags of the mask (including the tags inherited from the prefab)
+	struct TagQueryIt {
+		Entity entity;
+		bool   has_next;
+		u64    _tag_mask;
+		Tag    _tag;
+		u32    _index;
+		Entity _prefab;
+		u32    _prefab_index;
+	};
+
+	SV_API TagQueryIt tag_query_begin(u64 tag_mask);
+	SV_API void       tag_query_next(TagQueryIt& it);
+
+	// Iterates the components that are modified since the frame, included. The modifications are notified with get_entity_component_mut,
+	// mark_component_changed, CompItFlag_Write or the write mask of the queries.
+	// The changes are tracked per chunk, so the components of a changed chunk are returned even if they aren't modified.
+	// The transform changes are notified to all the components of the entity. The prefab components are returned with the prefab entity
+	struct ChangedIt {
+		Entity     entity;
+		Component* comp;
+		bool       has_next;
+		CompID     _comp_id;
+		u64        _frame;
+		u32        _archetype;
+		u32        _column;
+		u32        _row;
+	};
+
+	SV_API ChangedIt changed_since(CompID comp_id, u64 frame);
+	SV_API void      changed_next(ChangedIt& it);
+
+	constexpr u32 QUERY_COMPONENTS_MAX = ENTITY_COMPONENTS_MAX;
+
+	// Iterates the entities that have all the query components and none of the exclude mask.
+	// The components must be owned by the same entity (or by the same prefab entity)
+	struct QueryIt {
+		Entity     entity;
+		Component* comps[QUERY_COMPONENTS_MAX]; // Same order as the query components
+		bool       has_next;
+
+		u32    _query;
+		u32    _match_index;
+		u32    _row;
+		Entity _prefab;
+		u32    _prefab_index;
+		u32    _instance_index;
+		u64    _write_mask;
+	};
+
+	// The components of the write mask are marked as changed
+	SV_API QueryIt query_begin(const CompID* comp_ids, u32 comp_count, u64 exclude_mask = 0u, u64 write_mask = 0u);
+	SV_API void    query_next(QueryIt& query_it);
+
+	SV_INLINE QueryIt query_begin(std::initializer_list<CompID> comp_ids, u64 exclude_mask = 0u, u64 write_mask = 0u)
+	{
+		return query_begin(comp_ids.begin(), u32(comp_ids.size()), exclude_mask, write_mask);
+	}
+
 	// Tags
 
 	SV_API Tag         get_tag_id(const char* name);
@@ -182,6 +304,17 @@ namespace sv {
 	
 	// Components
 
+	enum ComponentRegisterFlag : u32 {
+		// The component data is stored in the archetype chunks of the entities, it is iterated without holes.
+		// The component memory is moved when the entity components change so the pointers must not be stored
+		ComponentRegisterFlag_Archetype = SV_BIT(0),
+		// The pools don't have holes, the last component is moved to the position of the removed one.
+		// Used for components that are added and removed frequently, the pointers must not be stored
+		ComponentRegisterFlag_Compact = SV_BIT(1),
+		// The snapshots use the copy constructor instead of the serialization. Only for components that don't own resources by pointer
+		ComponentRegisterFlag_Snapshot = SV_BIT(2),
+	};
+
 	void register_components();
 	void unregister_components();
 
@@ -191,6 +324,7 @@ namespace sv {
     SV_API CompID	   get_component_id(const char* name);
     SV_API u32		   get_component_register_count();
 	SV_API u32         get_component_count(CompID comp_id);
+	SV_API u32         get_component_flags(CompID comp_id);
 
     SV_API bool	component_exists(CompID comp_id);
 
@@ -218,7 +352,7 @@ namespace sv {
 	SV_API void set_entity_euler_rotationY(Entity entity, f32 rotation);
 	SV_API void set_entity_euler_rotationZ(Entity entity, f32 rotation);
 
-    // Local space getters
+    // Local space getters for writing, the pointer of a mirror creates an override. Use the const getters to read
     
     SV_API Transform* get_entity_transform_ptr(Entity entity);
     SV_API v3_f32*    get_entity_position_ptr(Entity entity);
@@ -250,6 +384,17 @@ namespace sv {
     SV_API v3_f32 get_entity_world_scale(Entity entity);
     SV_API XMMATRIX get_entity_world_matrix(Entity entity);
 
+	// Updates the dirty world matrices of the scene level by level using the task system. Called every frame after the scene update
+	SV_API void update_world_matrices();
+
+	// Queries over the bounding spheres of the entities (the unit cube transformed by the world matrix).
+	// The index is updated after the world matrix pass. The prefabs and the mirrors (the childs of the prefab instances) aren't
+	// included, only the root of the instances is returned. The mirrors have to be tested iterating the components of the prefabs
+	SV_API void   scene_query_aabb(const v3_f32& min, const v3_f32& max, List<Entity>& entities);
+	SV_API void   scene_query_sphere(const v3_f32& center, f32 radius, List<Entity>& entities);
+	SV_API void   scene_query_ray(const Ray& ray, List<Entity>& entities);
+	SV_API Entity scene_raycast(const Ray& ray, f32* distance = NULL); // Returns the closest entity
+
     ///////////////////////////////////////////////////////// COMPONENTS /////////////////////////////////////////////////////////
     
     constexpr u32 SPRITE_NAME_SIZE = 15u;
@@ -480,11 +625,31 @@ namespace sv {
     struct EntityDestroyEvent {
 		Entity entity;
     };
+
+    struct EntityParentEvent {
+		Entity entity;
+		Entity old_parent;
+		Entity parent;
+    };
+
+    struct EntitiesCreateEvent {
+		const Entity* entities;
+		u32 count;
+    };
+
+    struct EntitiesDestroyEvent {
+		const Entity* entities; // Includes the childs
+		u32 count;
+    };
     
 }
 
-#define foreach_component(comp_id, it, flags) for (CompIt it = comp_it_begin(comp_id); it.has_next; comp_it_next(it))
+#define foreach_component(comp_id, it, flags) for (CompIt it = comp_it_begin(comp_id, flags); it.has_next; comp_it_next(it))
 #define foreach_tag(tag_id, it, flags) for (TagIt it = tag_it_begin(tag_id); it.has_next; tag_it_next(it))
+#define foreach_changed(comp_id, frame, it) for (ChangedIt it = changed_since(comp_id, frame); it.has_next; changed_next(it))
+#define foreach_tag_query(tag_mask, it) for (TagQueryIt it = tag_query_begin(tag_mask); it.has_next; tag_query_next(it))
+#define foreach_query(it, exclude_mask, ...) for (QueryIt it = query_begin({ __VA_ARGS__ }, exclude_mask); it.has_next; query_next(it))
+#define foreach_query_write(it, exclude_mask, write_mask, ...) for (QueryIt it = query_begin({ __VA_ARGS__ }, exclude_mask, write_mask); it.has_next; query_next(it))
 
 #if SV_EDITOR
 #define __TAG(name) sv::get_tag_id(#name)
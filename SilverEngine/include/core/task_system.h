@@ -1,11 +1,13 @@
 #pragma once
 
-#include "core.h"
+#include "defines.h"
+#include "platform/os.h"
 
 namespace sv {
 
 	class ThreadPool;
 
+	// Works as a counter of the tasks submitted with it, it is used as a fence to wait a batch of tasks
 	class ThreadContext {
 		std::atomic<u32> executedTasks = 0u;
 		std::atomic<u32> taskCount = 0u;
@@ -19,12 +21,182 @@ namespace sv {
 		friend ThreadPool;
 	};
 
-	using TaskFunction = std::function<void()>;
-	
-	void task_execute(const TaskFunction& task, ThreadContext* context = nullptr, bool blockingTask = false);
-	void task_execute(TaskFunction* task, u32 count, ThreadContext* context, bool blockingTask = false);
-	void task_wait(const ThreadContext& context);
-	bool task_running(const ThreadContext& context);
-	u32 task_thread_count() noexcept;
+	constexpr u32 TASK_FUNCTION_SIZE = 48u;
 
-}
\ No newline at end of file
+	// Callable stored in an inline buffer, submitting a task never allocates memory.
+	// The captures can't be larger than TASK_FUNCTION_SIZE
+	class TaskFunction {
+	public:
+
+		TaskFunction() = default;
+		TaskFunction(std::nullptr_t) {}
+
+		template<typename F>
+		TaskFunction(const F& fn)
+		{
+			static_assert(sizeof(F) <= TASK_FUNCTION_SIZE, "The task captures are too big");
+			static_assert(alignof(F) <= 16u, "The task captures are overaligned");
+
+			new(_buffer) F(fn);
+			_invoke = [](void* ptr) { (*reinterpret_cast<F*>(ptr))(); };
+			_copy = [](void* dst, const void* src) { new(dst) F(*reinterpret_cast<const F*>(src)); };
+			_destroy = [](void* ptr) { reinterpret_cast<F*>(ptr)->~F(); };
+		}
+
+		TaskFunction(const TaskFunction& other)
+		{
+			_assign(other);
+		}
+
+		TaskFunction& operator=(const TaskFunction& other)
+		{
+			if (this != &other) {
+				reset();
+				_assign(other);
+			}
+			return *this;
+		}
+
+		TaskFunction& operator=(std::nullptr_t)
+		{
+			reset();
+			return *this;
+		}
+
+		~TaskFunction()
+		{
+			reset();
+		}
+
+		SV_INLINE void operator()() const
+		{
+			SV_ASSERT(_invoke);
+			_invoke(_buffer);
+		}
+
+		SV_INLINE explicit operator bool() const noexcept { return _invoke != nullptr; }
+
+		SV_INLINE void reset()
+		{
+			if (_destroy) _destroy(_buffer);
+			_invoke = nullptr;
+			_copy = nullptr;
+			_destroy = nullptr;
+		}
+
+	private:
+
+		SV_INLINE void _assign(const TaskFunction& other)
+		{
+			if (other._invoke) {
+				other._copy(_buffer, other._buffer);
+				_invoke = other._invoke;
+				_copy = other._copy;
+				_destroy = other._destroy;
+			}
+		}
+
+		alignas(16) mutable u8 _buffer[TASK_FUNCTION_SIZE];
+		void(*_invoke)(void*) = nullptr;
+		void(*_copy)(void*, const void*) = nullptr;
+		void(*_destroy)(void*) = nullptr;
+
+	};
+
+	// Blocking tasks (IO, long waits) never run in the main thread and never block the worker deques
+	SV_API void task_execute(const TaskFunction& task, ThreadContext* context = nullptr, bool blockingTask = false);
+	SV_API void task_execute(TaskFunction* task, u32 count, ThreadContext* context, bool blockingTask = false);
+
+	// The calling thread executes pending tasks while the context is running
+	SV_API void task_wait(const ThreadContext& context);
+	SV_API bool task_running(const ThreadContext& context);
+	SV_API u32  task_thread_count() noexcept;
+	SV_API u32  task_thread_index() noexcept; // Index of the calling thread, the main thread is 0 and the threads not created by the task system are u32_max
+
+	constexpr u32 TASK_PARALLEL_FOR_BATCH = 64u;
+
+	// Splits [begin, end) in ranges of 'grain' elements and calls fn(range_begin, range_end) for each one.
+	// With grain 0 the ranges are computed from the thread count. Returns when all the ranges are executed
+	template<typename F>
+	void task_parallel_for(u32 begin, u32 end, u32 grain, const F& fn)
+	{
+		if (begin >= end) return;
+
+		u32 count = end - begin;
+		u32 thread_count = task_thread_count();
+
+		if (grain == 0u)
+			grain = SV_MAX(count / (thread_count * 4u), 1u);
+
+		if (thread_count <= 1u || count <= grain) {
+			fn(begin, end);
+			return;
+		}
+
+		ThreadContext context;
+		TaskFunction tasks[TASK_PARALLEL_FOR_BATCH];
+		u32 task_count = 0u;
+		const F* f = &fn;
+
+		// The first range is executed by the calling thread
+		u32 i = begin + grain;
+
+		while (i < end) {
+
+			u32 range_end = (end - i > grain) ? (i + grain) : end;
+
+			tasks[task_count++] = [f, i, range_end]() { (*f)(i, range_end); };
+
+			if (task_count == TASK_PARALLEL_FOR_BATCH) {
+				task_execute(tasks, task_count, &context);
+				task_count = 0u;
+			}
+
+			i = range_end;
+		}
+
+		if (task_count)
+			task_execute(tasks, task_count, &context);
+
+		fn(begin, begin + grain);
+		task_wait(context);
+	}
+
+	// Task graph: the tasks are executed when all their dependencies are finished
+
+	struct TaskGraphNode {
+		TaskFunction function;
+		u32          dependency_count;
+		u32          successor_begin;
+		u32          successor_count;
+		bool         blocking;
+	};
+
+	struct TaskGraphEdge {
+		u32 task;
+		u32 dependency;
+	};
+
+	struct TaskGraph {
+		List<TaskGraphNode> nodes;
+		List<TaskGraphEdge> edges;
+
+		List<u32>         _successors;
+		std::atomic<u32>* _pending = nullptr;
+		u32               _pending_count = 0u;
+		ThreadContext     _context;
+	};
+
+	SV_API u32  task_graph_add(TaskGraph& graph, const TaskFunction& task, bool blockingTask = false); // Returns the task index
+	SV_API void task_graph_depend(TaskGraph& graph, u32 task, u32 dependency); // The task waits until the dependency is finished
+
+	// The graph must not be modified or destroyed until it ends
+	SV_API void task_graph_execute(TaskGraph& graph);
+	SV_API void task_graph_wait(TaskGraph& graph);
+	SV_API bool task_graph_running(const TaskGraph& graph);
+	SV_API void task_graph_clear(TaskGraph& graph);
+
+	bool _task_initialize();
+	void _task_close();
+
+}
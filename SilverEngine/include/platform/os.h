@@ -112,8 +112,21 @@ namespace sv {
     SV_API bool folder_iterator_begin(const char* folderpath, FolderIterator* iterator, FolderElement* element);
     SV_API bool folder_iterator_next(FolderIterator* iterator, FolderElement* element);
     SV_API void folder_iterator_close(FolderIterator* iterator);
+
+    // Notifies the files created, modified or renamed inside a folder and its subfolders
+    struct FileWatcher;
+
+    SV_API FileWatcher* file_watcher_create(const char* folderpath);
+    SV_API void         file_watcher_destroy(FileWatcher* watcher);
+    // Doesn't block, returns false if there are no more changes. The filepath (FILEPATH_SIZE + 1) starts with the watched folder
+    SV_API bool         file_watcher_next(FileWatcher* watcher, char* filepath);
+    // Returns true once if some changes weren't notified (the buffer overflowed), all the files must be checked
+    SV_API bool         file_watcher_lost_changes(FileWatcher* watcher);
+    // Returns false if the folder can't be watched anymore, the watcher must be destroyed
+    SV_API bool         file_watcher_valid(FileWatcher* watcher);
     
     SV_API bool load_image(const char* filePath, void** pdata, u32* width, u32* height);
+    SV_API bool load_image_from_memory(const void* src, size_t size, void** pdata, u32* width, u32* height);
 
     // TODO: Move to utils/serialize.h
     SV_API bool bin_read(u64 hash, RawList& data, bool system = false);
@@ -142,6 +155,25 @@ namespace sv {
 
 #define SV_LOCK_GUARD(mutex, name) _LockGuard name(&mutex);
 
+	struct Semaphore { u64 _handle = 0u; };
+
+	SV_API bool semaphore_create(Semaphore& semaphore, u32 initial_count, u32 max_count);
+	SV_API void semaphore_destroy(Semaphore semaphore);
+
+	SV_API void semaphore_wait(Semaphore semaphore);
+	SV_API void semaphore_release(Semaphore semaphore, u32 count = 1u);
+
+	struct Thread { u64 _handle = 0u; };
+
+	typedef void(*ThreadMainFn)(void* data);
+
+	SV_API bool thread_create(Thread& thread, ThreadMainFn main_fn, void* data);
+	SV_API void thread_wait(Thread thread); // Waits until the thread ends and frees the handle
+	SV_API void thread_yield();
+	SV_API void thread_sleep(u32 millis);
+
+	SV_API u32 os_cpu_count();
+
 	// DYNAMIC LIBRARIES
 
 	typedef u64 Library;
@@ -700,8 +700,20 @@ namespace sv {
 			// Is root
 			if (parent == nullptr) {
 
-				entry->value.~T();
-				entry->hash = 0u;
+				Entry* next = entry->next;
+
+				// The root can't be empty while has childs, the iterator and the lookups skip them
+				if (next) {
+
+					entry->value = std::move(next->value);
+					entry->hash = next->hash;
+					entry->next = next->next;
+					SV_FREE_STRUCT(next);
+				}
+				else {
+					entry->value.~T();
+					entry->hash = 0u;
+				}
 			}
 			else {
 
@@ -709,6 +721,7 @@ namespace sv {
 				SV_FREE_STRUCT(entry);
 			}
 
+			--_size;
 			return true;
 		}
 
@@ -871,6 +871,93 @@ namespace sv {
 		return XMMatrixInverse(NULL, XMMatrixTranspose(XMLoadFloat4x4(&mat)));
 	}
 
+	// Transforms stored in separated arrays
+	struct TransformStream {
+		const f32* position[3];
+		const f32* rotation[4];
+		const f32* scale[3];
+	};
+
+	// Computes the matrices (scale * rotation * translation) of the transforms in [begin, end).
+	// Builds 4 matrices at once with SSE, the remainder is computed one by one
+	SV_INLINE void mat_compose_stream(const TransformStream& s, u32 begin, u32 end, XMFLOAT4X4* matrices)
+	{
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 two = _mm_set1_ps(2.f);
+		const __m128 zero = _mm_setzero_ps();
+
+		u32 i = begin;
+
+		for (; i + 4u <= end; i += 4u) {
+
+			__m128 x = _mm_loadu_ps(s.rotation[0] + i);
+			__m128 y = _mm_loadu_ps(s.rotation[1] + i);
+			__m128 z = _mm_loadu_ps(s.rotation[2] + i);
+			__m128 w = _mm_loadu_ps(s.rotation[3] + i);
+
+			__m128 x2 = _mm_mul_ps(x, two);
+			__m128 y2 = _mm_mul_ps(y, two);
+			__m128 z2 = _mm_mul_ps(z, two);
+
+			__m128 xx = _mm_mul_ps(x, x2);
+			__m128 yy = _mm_mul_ps(y, y2);
+			__m128 zz = _mm_mul_ps(z, z2);
+			__m128 xy = _mm_mul_ps(x, y2);
+			__m128 xz = _mm_mul_ps(x, z2);
+			__m128 yz = _mm_mul_ps(y, z2);
+			__m128 wx = _mm_mul_ps(w, x2);
+			__m128 wy = _mm_mul_ps(w, y2);
+			__m128 wz = _mm_mul_ps(w, z2);
+
+			__m128 sx = _mm_loadu_ps(s.scale[0] + i);
+			__m128 sy = _mm_loadu_ps(s.scale[1] + i);
+			__m128 sz = _mm_loadu_ps(s.scale[2] + i);
+
+			// Each register contains the same element of the 4 matrices
+			__m128 r0x = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_add_ps(yy, zz)));
+			__m128 r0y = _mm_mul_ps(sx, _mm_add_ps(xy, wz));
+			__m128 r0z = _mm_mul_ps(sx, _mm_sub_ps(xz, wy));
+			__m128 r0w = zero;
+
+			__m128 r1x = _mm_mul_ps(sy, _mm_sub_ps(xy, wz));
+			__m128 r1y = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_add_ps(xx, zz)));
+			__m128 r1z = _mm_mul_ps(sy, _mm_add_ps(yz, wx));
+			__m128 r1w = zero;
+
+			__m128 r2x = _mm_mul_ps(sz, _mm_add_ps(xz, wy));
+			__m128 r2y = _mm_mul_ps(sz, _mm_sub_ps(yz, wx));
+			__m128 r2z = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_add_ps(xx, yy)));
+			__m128 r2w = zero;
+
+			__m128 r3x = _mm_loadu_ps(s.position[0] + i);
+			__m128 r3y = _mm_loadu_ps(s.position[1] + i);
+			__m128 r3z = _mm_loadu_ps(s.position[2] + i);
+			__m128 r3w = one;
+
+			// Transpose to get the rows of each matrix
+			_MM_TRANSPOSE4_PS(r0x, r0y, r0z, r0w);
+			_MM_TRANSPOSE4_PS(r1x, r1y, r1z, r1w);
+			_MM_TRANSPOSE4_PS(r2x, r2y, r2z, r2w);
+			_MM_TRANSPOSE4_PS(r3x, r3y, r3z, r3w);
+
+			XMFLOAT4X4* m = matrices + i;
+
+			_mm_storeu_ps(&m[0]._11, r0x); _mm_storeu_ps(&m[0]._21, r1x); _mm_storeu_ps(&m[0]._31, r2x); _mm_storeu_ps(&m[0]._41, r3x);
+			_mm_storeu_ps(&m[1]._11, r0y); _mm_storeu_ps(&m[1]._21, r1y); _mm_storeu_ps(&m[1]._31, r2y); _mm_storeu_ps(&m[1]._41, r3y);
+			_mm_storeu_ps(&m[2]._11, r0z); _mm_storeu_ps(&m[2]._21, r1z); _mm_storeu_ps(&m[2]._31, r2z); _mm_storeu_ps(&m[2]._41, r3z);
+			_mm_storeu_ps(&m[3]._11, r0w); _mm_storeu_ps(&m[3]._21, r1w); _mm_storeu_ps(&m[3]._31, r2w); _mm_storeu_ps(&m[3]._41, r3w);
+		}
+
+		for (; i < end; ++i) {
+
+			XMMATRIX m = XMMatrixScaling(s.scale[0][i], s.scale[1][i], s.scale[2][i])
+				* XMMatrixRotationQuaternion(XMVectorSet(s.rotation[0][i], s.rotation[1][i], s.rotation[2][i], s.rotation[3][i]))
+				* XMMatrixTranslation(s.position[0][i], s.position[1][i], s.position[2][i]);
+
+			XMStoreFloat4x4(matrices + i, m);
+		}
+	}
+
 	// Quaternion
 
 	// TODO: WTF is going on
@@ -265,6 +265,7 @@ namespace sv {
     };
 
     SV_API bool deserialize_begin(Deserializer& d, const char* filepath);
+    SV_API bool deserialize_begin(Deserializer& d, const void* data, size_t size); // The data is copied
     SV_API void deserialize_end(Deserializer& d);
 
     SV_INLINE bool deserialize_assert(Deserializer& d, size_t size)
@@ -1,14 +1,23 @@
 #include "core/asset_system.h"
 #include "utils/allocators.h"
 #include "utils/string.h"
+#include "core/task_system.h"
 
 namespace sv {
 
     // Time to update one asset type, after this time will update the next type
     constexpr float UNUSED_CHECK_TIME = 1.f;
+	// Time between the evictions while the memory budget is exceeded
+	constexpr float BUDGET_CHECK_TIME = 0.25f;
 
 	struct Asset_internal;
 
+	enum AssetState : u32 {
+		AssetState_Loaded,
+		AssetState_Loading,
+		AssetState_Failed,
+	};
+
     struct AssetType_internal {
 
 		char	          name[ASSET_TYPE_NAME_SIZE + 1u];
@@ -16,12 +25,31 @@ namespace sv {
 		AssetLoadFileFn	  load_file_fn;
 		AssetReloadFileFn reload_file_fn;
 		AssetFreeFn 	  free_fn;
+		AssetDecodeFn      decode_fn;
+		AssetUploadFn      upload_fn;
+		AssetFreeDecodedFn free_decoded_fn;
+		AssetMemoryFn     memory_fn;
 		f32		          unused_time;
+		u32               asset_size;
 		f64		          last_update = 0.0;
 		u32               extension_count;
 		char              extensions[ASSET_EXTENSION_NAME_SIZE + 1u][ASSET_TYPE_EXTENSION_MAX];
 		
 		ThickHashTable<Asset_internal*, 100u> name_table;
+
+		// Load timings in nanoseconds
+		std::atomic<u32> load_count = 0u;
+		std::atomic<u64> read_time = 0u;
+		std::atomic<u64> decode_time = 0u;
+		std::atomic<u64> upload_time = 0u;
+		std::atomic<u64> load_time = 0u;
+
+		// Resident memory of the loaded assets, 0 budget means no limit
+		std::atomic<u32> resident_count = 0u;
+		std::atomic<u64> cpu_bytes = 0u;
+		std::atomic<u64> gpu_bytes = 0u;
+		u64 cpu_budget = 0u;
+		u64 gpu_budget = 0u;
 		
 		SizedInstanceAllocator allocator;
 
@@ -29,9 +57,15 @@ namespace sv {
 
     };
 
+	struct AssetFilepath {
+		char filepath[FILEPATH_SIZE + 1u];
+	};
+
     struct Asset_internal {
 
 		std::atomic<i32>	ref_count = 0;
+		// The content is published when the state changes to loaded
+		std::atomic<u32>    state = AssetState_Loaded;
 		f32					unused_time = f32_max;
 		bool                created_from_name = false;
 		// TODO: Move on
@@ -39,9 +73,27 @@ namespace sv {
 		Date                last_write_date;
 		char			    name[ASSET_NAME_SIZE + 1u] = "";
 		AssetType_internal* type = NULL;
+		// Assets loaded from the files while loading this asset
+		List<AssetFilepath> dependencies;
+		// Measured when the asset is loaded
+		u64                 cpu_bytes = 0u;
+		u64                 gpu_bytes = 0u;
+		// Frame of the last access, used to evict the least recently used assets
+		std::atomic<u64>    last_use = 0u;
 
     };
 
+	// File data waiting to be decoded
+	struct AssetStaging {
+		Asset_internal* asset;
+		RawList         data;
+	};
+
+	struct AssetUpload {
+		Asset_internal* asset;
+		void*           decoded;
+	};
+
 	struct AssetSystemData {
 		
 		List<AssetType_internal*>             asset_types;
@@ -51,15 +103,79 @@ namespace sv {
 		u32 check_type_index = 0u;
 		f32 check_time = 0.f;
 		List<Asset_internal*> free_assets_list;
+
+		// The assets can be loaded from the worker threads
+		Mutex mutex;
+
+		// Decoded assets waiting for the upload in the main thread
+		List<AssetUpload> upload_queue;
+		List<AssetUpload> upload_list;
+		Mutex             upload_mutex;
+
+		// Assets serialized while a manifest is recorded, the manifests can be nested
+		List<Asset_internal*> manifest_assets;
+		List<u32>             manifest_stack;
+
+		// Global memory budget, 0 means no limit
+		u64 cpu_budget = 0u;
+		u64 gpu_budget = 0u;
+		f32 budget_check_time = 0.f;
+
+		// Hot reload, NULL if the folder can't be watched. The changed files of the unused or loading assets are kept in the queue
+		FileWatcher*        watcher = NULL;
+		List<AssetFilepath> reload_queue;
 		
 	};
 
     static AssetSystemData* asset_system = NULL;
 
+	// Used to find the dependencies of the asset
+	static thread_local Asset_internal* current_loading_asset = NULL;
+
+	SV_AUX void add_asset_memory(Asset_internal* asset)
+	{
+		AssetType_internal* type = asset->type;
+		
+		u64 cpu = type->asset_size;
+		u64 gpu = 0u;
+
+		if (type->memory_fn) {
+
+			size_t cpu_bytes = 0u;
+			size_t gpu_bytes = 0u;
+			type->memory_fn(asset + 1u, &cpu_bytes, &gpu_bytes);
+			cpu += cpu_bytes;
+			gpu += gpu_bytes;
+		}
+
+		asset->cpu_bytes = cpu;
+		asset->gpu_bytes = gpu;
+		asset->last_use.store(engine.frame_count, std::memory_order_relaxed);
+
+		type->resident_count.fetch_add(1u, std::memory_order_relaxed);
+		type->cpu_bytes.fetch_add(cpu, std::memory_order_relaxed);
+		type->gpu_bytes.fetch_add(gpu, std::memory_order_relaxed);
+	}
+
+	SV_AUX void remove_asset_memory(Asset_internal* asset)
+	{
+		AssetType_internal* type = asset->type;
+
+		type->resident_count.fetch_sub(1u, std::memory_order_relaxed);
+		type->cpu_bytes.fetch_sub(asset->cpu_bytes, std::memory_order_relaxed);
+		type->gpu_bytes.fetch_sub(asset->gpu_bytes, std::memory_order_relaxed);
+
+		asset->cpu_bytes = 0u;
+		asset->gpu_bytes = 0u;
+	}
+
     SV_AUX bool destroy_asset(Asset_internal* asset, AssetType_internal* type)
     {
-		bool res = type->free_fn(asset + 1u, asset->name);
-		type->allocator.free(asset);
+		bool res = true;
+		if (asset->state.load() == AssetState_Loaded) {
+			res = type->free_fn(asset + 1u, asset->name);
+			remove_asset_memory(asset);
+		}
 
 		bool log = false;
 
@@ -88,15 +204,271 @@ namespace sv {
 			log = true;
 		}
 
+		asset->~Asset_internal();
+		type->allocator.free(asset);
+
 		return res;
     }
 
+	SV_AUX u64 elapsed_ns(f64 begin)
+	{
+		return u64((timer_now() - begin) * 1000000000.0);
+	}
+
+	// Publishes the result of the loading
+	SV_AUX void finish_asset_loading(Asset_internal* asset, bool res)
+	{
+		AssetType_internal* type = asset->type;
+		
+		if (res) {
+			add_asset_memory(asset);
+			type->load_count.fetch_add(1u, std::memory_order_relaxed);
+			SV_LOG_INFO("%s loaded: %s", type->name, asset->filepath);
+		}
+		else SV_LOG_ERROR("Can't load the asset '%s'", asset->filepath);
+
+		asset->state.store(res ? AssetState_Loaded : AssetState_Failed, std::memory_order_release);
+	}
+
+	SV_AUX bool upload_asset(Asset_internal* asset, void* decoded)
+	{
+		AssetType_internal* type = asset->type;
+		
+		f64 t0 = timer_now();
+		bool res = type->upload_fn(asset + 1u, asset->name, decoded);
+		type->upload_time.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+
+		if (type->free_decoded_fn) type->free_decoded_fn(decoded);
+		return res;
+	}
+
+	SV_AUX void upload_pending_assets()
+	{
+		{
+			SV_LOCK_GUARD(asset_system->upload_mutex, lock);
+
+			for (const AssetUpload& upload : asset_system->upload_queue)
+				asset_system->upload_list.push_back(upload);
+			
+			asset_system->upload_queue.reset();
+		}
+
+		for (const AssetUpload& upload : asset_system->upload_list) {
+
+			Asset_internal* asset = upload.asset;
+			
+			finish_asset_loading(asset, upload_asset(asset, upload.decoded));
+			asset->ref_count.fetch_add(-1);
+		}
+
+		asset_system->upload_list.reset();
+	}
+
+	SV_AUX bool is_over_budget(u64 bytes, u64 budget)
+	{
+		return budget != 0u && bytes > budget;
+	}
+
+	SV_AUX bool type_over_budget(AssetType_internal* type)
+	{
+		return is_over_budget(type->cpu_bytes.load(std::memory_order_relaxed), type->cpu_budget)
+			|| is_over_budget(type->gpu_bytes.load(std::memory_order_relaxed), type->gpu_budget);
+	}
+
+	// Frees the unreferenced assets, the least recently used first, until the budgets are respected
+	SV_AUX void evict_assets()
+	{
+		u64 cpu = 0u;
+		u64 gpu = 0u;
+		bool over = false;
+		
+		for (AssetType_internal* type : asset_system->asset_types) {
+			
+			cpu += type->cpu_bytes.load(std::memory_order_relaxed);
+			gpu += type->gpu_bytes.load(std::memory_order_relaxed);
+			over = over || type_over_budget(type);
+		}
+
+		bool global_over = is_over_budget(cpu, asset_system->cpu_budget) || is_over_budget(gpu, asset_system->gpu_budget);
+
+		if (!over && !global_over)
+			return;
+
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+
+		List<Asset_internal*>& list = asset_system->free_assets_list;
+		list.reset();
+
+		for (AssetType_internal* type : asset_system->asset_types) {
+			for (auto& pool : type->allocator) {
+				for (void* _ptr : pool) {
+
+					Asset_internal* asset = reinterpret_cast<Asset_internal*>(_ptr);
+
+					if (asset->ref_count.load() <= 0 && asset->state.load() == AssetState_Loaded)
+						list.push_back(asset);
+				}
+			}
+		}
+
+		std::sort(list.data(), list.data() + list.size(), [](const Asset_internal* a0, const Asset_internal* a1) {
+			return a0->last_use.load(std::memory_order_relaxed) < a1->last_use.load(std::memory_order_relaxed);
+		});
+
+		for (Asset_internal* asset : list) {
+
+			AssetType_internal* type = asset->type;
+			
+			if (!global_over && !type_over_budget(type))
+				continue;
+
+			cpu -= asset->cpu_bytes;
+			gpu -= asset->gpu_bytes;
+
+			destroy_asset(asset, type);
+
+			global_over = is_over_budget(cpu, asset_system->cpu_budget) || is_over_budget(gpu, asset_system->gpu_budget);
+		}
+
+		list.reset();
+	}
+
+#if SV_EDITOR
+	SV_AUX void reload_asset_if_changed(Asset_internal* asset)
+	{
+		AssetType_internal* type = asset->type;
+		
+		Date last_write;
+		if (file_date(asset->filepath, NULL, &last_write, NULL)) {
+
+			if (asset->last_write_date != last_write) {
+
+				remove_asset_memory(asset);
+									
+				if (type->reload_file_fn(asset + 1u, asset->name, asset->filepath)) {
+					SV_LOG_INFO("%s asset reloaded: '%s'", type->name, asset->filepath);
+				}
+				else {
+					SV_LOG_ERROR("Can't reload the %s asset: '%s'", type->name, asset->filepath);
+				}
+
+				add_asset_memory(asset);
+
+				asset->last_write_date = last_write;
+			}
+		}
+	}
+
+	// Returns true if all the files must be checked
+	SV_AUX bool read_file_changes()
+	{
+		List<AssetFilepath>& queue = asset_system->reload_queue;
+		FileWatcher* watcher = asset_system->watcher;
+		char filepath[FILEPATH_SIZE + 1u];
+		
+		while (file_watcher_next(watcher, filepath)) {
+
+			// The same file is usually notified more than once
+			bool repeated = false;
+			
+			for (const AssetFilepath& f : queue) {
+				if (string_equals(f.filepath, filepath)) {
+					repeated = true;
+					break;
+				}
+			}
+
+			if (!repeated) {
+				AssetFilepath& f = queue.emplace_back();
+				string_copy(f.filepath, filepath, FILEPATH_SIZE + 1u);
+			}
+		}
+
+		bool check_all = file_watcher_lost_changes(watcher);
+
+		if (!file_watcher_valid(watcher)) {
+
+			SV_LOG_WARNING("The assets folder can't be watched, the files are polled");
+			file_watcher_destroy(watcher);
+			asset_system->watcher = NULL;
+			check_all = true;
+		}
+
+		return check_all;
+	}
+
+	// Only the changed files are checked
+	SV_AUX void reload_changed_assets()
+	{
+		List<AssetFilepath>& queue = asset_system->reload_queue;
+		
+		bool check_all = asset_system->watcher && read_file_changes();
+
+		if (queue.empty() && !check_all)
+			return;
+
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+
+		// Some notifications are lost, the dates of all the assets are compared
+		if (check_all) {
+
+			queue.reset();
+
+			for (Asset_internal* asset : asset_system->filepath_table) {
+				AssetFilepath& f = queue.emplace_back();
+				string_copy(f.filepath, asset->filepath, FILEPATH_SIZE + 1u);
+			}
+		}
+
+		u32 count = 0u;
+
+		foreach(i, queue.size()) {
+
+			Asset_internal** asset_ = asset_system->filepath_table.find(queue[i].filepath);
+			if (asset_ == NULL) continue;
+
+			Asset_internal* asset = *asset_;
+			AssetState state = asset->state.load();
+
+			if (asset->type->reload_file_fn == NULL || state == AssetState_Failed)
+				continue;
+
+			// Checked when are referenced and loaded
+			if (asset->ref_count.load() <= 0 || state != AssetState_Loaded) {
+				queue[count++] = queue[i];
+				continue;
+			}
+			
+			reload_asset_if_changed(asset);
+		}
+
+		queue.resize(count);
+	}
+#endif
+
     void _update_assets()
     {
+		upload_pending_assets();
+
+#if SV_EDITOR
+		if (asset_system->watcher || asset_system->reload_queue.size())
+			reload_changed_assets();
+#endif
+
+		asset_system->budget_check_time += engine.deltatime;
+
+		if (asset_system->budget_check_time >= BUDGET_CHECK_TIME) {
+			
+			evict_assets();
+			asset_system->budget_check_time = 0.f;
+		}
+		
 		asset_system->check_time += engine.deltatime;
 
 		if (asset_system->check_time >= UNUSED_CHECK_TIME) {
 
+			SV_LOCK_GUARD(asset_system->mutex, lock);
+
 			AssetType_internal* type = asset_system->asset_types[asset_system->check_type_index];
 			asset_system->free_assets_list.reset();
 
@@ -128,23 +500,10 @@ namespace sv {
 						asset->unused_time = f32_max;
 
 #if SV_EDITOR
-						if (asset->filepath[0] && type->reload_file_fn) {
+						// Without file watcher the files are polled
+						if (asset_system->watcher == NULL && asset->filepath[0] && type->reload_file_fn && asset->state.load() == AssetState_Loaded) {
 
-							Date last_write;
-							if (file_date(asset->filepath, NULL, &last_write, NULL)) {
-
-								if (asset->last_write_date != last_write) {
-
-									if (type->reload_file_fn(asset + 1u, asset->name, asset->filepath)) {
-										SV_LOG_INFO("%s asset reloaded: '%s'", type->name, asset->filepath);
-									}
-									else {
-										SV_LOG_ERROR("Can't reload the %s asset: '%s'", type->name, asset->filepath);
-									}
-
-									asset->last_write_date = last_write;
-								}
-							}
+							reload_asset_if_changed(asset);
 						}
 #endif
 					}
@@ -167,11 +526,29 @@ namespace sv {
 	void _initialize_assets()
 	{
 		asset_system = SV_ALLOCATE_STRUCT(AssetSystemData, "AssetSystem");
+		mutex_create(asset_system->mutex);
+		mutex_create(asset_system->upload_mutex);
+
+#if SV_EDITOR
+		asset_system->watcher = file_watcher_create("assets");
+#endif
 	}
 
     void _close_assets()
     {
 		if (asset_system) {
+
+			// The task system is closed, discard the assets that are not uploaded
+			for (const AssetUpload& upload : asset_system->upload_queue) {
+
+				Asset_internal* asset = upload.asset;
+				
+				if (asset->type->free_decoded_fn) asset->type->free_decoded_fn(upload.decoded);
+				asset->state.store(AssetState_Failed);
+				asset->ref_count.fetch_add(-1);
+			}
+			asset_system->upload_queue.clear();
+			asset_system->upload_list.clear();
 			
 			free_unused_assets();
 
@@ -186,6 +563,15 @@ namespace sv {
 			asset_system->extension_table.clear();
 
 			asset_system->free_assets_list.clear();
+			asset_system->manifest_assets.clear();
+			asset_system->manifest_stack.clear();
+
+			file_watcher_destroy(asset_system->watcher);
+			asset_system->watcher = NULL;
+			asset_system->reload_queue.clear();
+
+			mutex_destroy(asset_system->mutex);
+			mutex_destroy(asset_system->upload_mutex);
 
 			SV_FREE_STRUCT(asset_system);
 			asset_system = NULL;
@@ -254,7 +640,7 @@ namespace sv {
 		return true;
 	}
 
-    bool create_asset(AssetPtr& asset_ptr, const char* asset_type_name, const char* name)
+    SV_AUX bool create_asset_internal(AssetPtr& asset_ptr, const char* asset_type_name, const char* name)
     {
 		AssetType_internal* type = get_type_from_typename(asset_type_name);
 		if (type == nullptr) {
@@ -279,6 +665,7 @@ namespace sv {
 
 		if (!type->create_fn(asset + 1u, name)) {
 
+			asset->~Asset_internal();
 			type->allocator.free(asset);
 			return false;
 		}
@@ -286,6 +673,8 @@ namespace sv {
 		if (string_size(name))
 			type->name_table[name] = asset;
 
+		add_asset_memory(asset);
+
 		asset_ptr = AssetPtr(asset);
 
 		SV_LOG_INFO("%s created", type->name);
@@ -293,8 +682,16 @@ namespace sv {
 		return true;
     }
 
+    bool create_asset(AssetPtr& asset_ptr, const char* asset_type_name, const char* name)
+    {
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+		return create_asset_internal(asset_ptr, asset_type_name, name);
+    }
+
 	bool create_asset_from_name(AssetPtr& asset_ptr, const char* asset_type_name, const char* name)
 	{
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+		
 		AssetType_internal* type = get_type_from_typename(asset_type_name);
 		if (type == NULL) {
 			SV_LOG_ERROR("Asset type '%s' not found", asset_type_name);
@@ -309,7 +706,7 @@ namespace sv {
 			return true;
 		}
 		else {
-			if (create_asset(asset_ptr, asset_type_name, name)) {
+			if (create_asset_internal(asset_ptr, asset_type_name, name)) {
 
 				Asset_internal* asset = reinterpret_cast<Asset_internal*>(asset_ptr.ptr);
 				asset->created_from_name = true;
@@ -320,50 +717,230 @@ namespace sv {
 		}
 	}
 
+	// Creates the asset in loading state and adds it to the filepath table, must be called with the mutex locked
+	SV_AUX Asset_internal* reserve_asset(const char* filepath)
+	{
+		size_t size = string_size(filepath);
+		AssetType_internal* type = get_type_from_filepath(size, filepath);
+		if (type == NULL) return NULL;
+
+		Asset_internal* asset = new(type->allocator.alloc()) Asset_internal();
+		asset->type = type;
+		asset->state.store(AssetState_Loading);
+		string_copy(asset->filepath, filepath, FILEPATH_SIZE + 1u);
+
+		asset_system->filepath_table[filepath] = asset;
+
+		return asset;
+	}
+
+	// The date is taken before reading, a change in the middle of the loading is reloaded later
+	SV_AUX void read_asset_date(Asset_internal* asset)
+	{
+		file_date(asset->filepath, NULL, &asset->last_write_date, NULL);
+	}
+
+	SV_AUX bool read_asset_file(Asset_internal* asset, RawList& data)
+	{
+		f64 t0 = timer_now();
+		bool res = file_read_binary(asset->filepath, data);
+		asset->type->read_time.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+		return res;
+	}
+
+	SV_AUX void* decode_asset(Asset_internal* asset, const RawList& data)
+	{
+		AssetType_internal* type = asset->type;
+		
+		f64 t0 = timer_now();
+		void* decoded = type->decode_fn(asset->filepath, data.data(), data.size());
+		type->decode_time.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+		return decoded;
+	}
+
+	// Executes all the stages in the current thread
+	SV_AUX bool load_asset_content(Asset_internal* asset)
+	{
+		AssetType_internal* type = asset->type;
+		bool res;
+
+		Asset_internal* parent_asset = current_loading_asset;
+		current_loading_asset = asset;
+
+		read_asset_date(asset);
+
+		if (type->decode_fn) {
+
+			RawList data;
+			void* decoded = NULL;
+			
+			if (read_asset_file(asset, data))
+				decoded = decode_asset(asset, data);
+
+			res = decoded != NULL && upload_asset(asset, decoded);
+		}
+		else {
+			
+			f64 t0 = timer_now();
+			res = type->load_file_fn(asset + 1u, asset->name, asset->filepath);
+			type->load_time.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+		}
+
+		current_loading_asset = parent_asset;
+
+		finish_asset_loading(asset, res);
+		return res;
+	}
+
+	SV_AUX void decode_asset_staged(AssetStaging* staging)
+	{
+		Asset_internal* asset = staging->asset;
+		
+		void* decoded = decode_asset(asset, staging->data);
+		SV_FREE_STRUCT(staging);
+
+		if (decoded == NULL) {
+			finish_asset_loading(asset, false);
+			asset->ref_count.fetch_add(-1);
+			return;
+		}
+
+		SV_LOCK_GUARD(asset_system->upload_mutex, lock);
+		asset_system->upload_queue.push_back({ asset, decoded });
+	}
+
+	// Executed in a blocking task, the decoding is sent to a non blocking task to keep the IO threads free
+	SV_AUX void read_asset_staged(Asset_internal* asset)
+	{
+		AssetStaging* staging = SV_ALLOCATE_STRUCT(AssetStaging, "AssetSystem");
+		staging->asset = asset;
+
+		read_asset_date(asset);
+
+		if (!read_asset_file(asset, staging->data)) {
+
+			SV_FREE_STRUCT(staging);
+			finish_asset_loading(asset, false);
+			asset->ref_count.fetch_add(-1);
+			return;
+		}
+
+		task_execute([staging]() { decode_asset_staged(staging); });
+	}
+
+	// Takes the decoded data if the asset is waiting for the upload
+	SV_AUX void* take_pending_upload(Asset_internal* asset)
+	{
+		SV_LOCK_GUARD(asset_system->upload_mutex, lock);
+
+		foreach(i, asset_system->upload_queue.size()) {
+
+			AssetUpload upload = asset_system->upload_queue[i];
+
+			if (upload.asset == asset) {
+				asset_system->upload_queue.erase(i);
+				return upload.decoded;
+			}
+		}
+
+		return NULL;
+	}
+
 	SV_AUX bool load_asset_right_now(AssetPtr& asset_ptr, const char* filepath)
 	{
+		mutex_lock(asset_system->mutex);
+		
 		Asset_internal** asset_ = asset_system->filepath_table.find(filepath);
 
 		if (asset_ == NULL) {
 
-			size_t size = string_size(filepath);
-			AssetType_internal* type = get_type_from_filepath(size, filepath);
-			if (type == NULL) return false;
+			Asset_internal* asset = reserve_asset(filepath);
 
-			Asset_internal* asset = new(type->allocator.alloc()) Asset_internal();
-			asset->type = type;
+			// The reference is taken inside the lock, the asset can't be freed while is loading
+			if (asset) asset_ptr = AssetPtr(asset);
+			mutex_unlock(asset_system->mutex);
 
-			if (!type->load_file_fn(asset + 1u, asset->name, filepath)) {
+			if (asset == NULL) return false;
 
-				SV_LOG_ERROR("Can't load the asset '%s'", filepath);
-
-				type->allocator.free(asset);
+			// Other threads can be waiting for the asset, is freed when the last reference is released
+			if (!load_asset_content(asset)) {
+				unload_asset(asset_ptr);
 				return false;
 			}
-
-			asset_system->filepath_table[filepath] = asset;
-			string_copy(asset->filepath, filepath, FILEPATH_SIZE + 1u);
+		}
+		else {
+			Asset_internal* asset = *asset_;
 			asset_ptr = AssetPtr(asset);
+			mutex_unlock(asset_system->mutex);
 
-			file_date(filepath, NULL, &asset->last_write_date, NULL);
+			// Loading in other thread
+			while (asset->state.load(std::memory_order_acquire) == AssetState_Loading) {
 
-			SV_LOG_INFO("%s loaded: %s", type->name, filepath);
-		}
-		else {
-			asset_ptr = AssetPtr(*asset_);
+				// Don't wait for the next frame to upload it
+				void* decoded = take_pending_upload(asset);
+				
+				if (decoded) {
+					finish_asset_loading(asset, upload_asset(asset, decoded));
+					asset->ref_count.fetch_add(-1);
+				}
+				else thread_yield();
+			}
+
+			if (asset->state.load() == AssetState_Failed) {
+				unload_asset(asset_ptr);
+				return false;
+			}
 		}
 
 		return true;
 	}
 
+	// Returns the asset in loading state, the content is loaded in a worker thread
 	SV_AUX bool load_asset_keep_it_loading(AssetPtr& asset_ptr, const char* filepath)
 	{
-		// TODO
-		return load_asset_right_now(asset_ptr, filepath);
+		mutex_lock(asset_system->mutex);
+		
+		Asset_internal** asset_ = asset_system->filepath_table.find(filepath);
+
+		if (asset_) {
+			asset_ptr = AssetPtr(*asset_);
+			mutex_unlock(asset_system->mutex);
+			return true;
+		}
+
+		Asset_internal* asset = reserve_asset(filepath);
+
+		if (asset) {
+			asset_ptr = AssetPtr(asset);
+
+			// The task keeps a reference, the asset can't be freed while is loading
+			asset->ref_count.fetch_add(1);
+		}
+
+		// Without workers the task is executed here
+		mutex_unlock(asset_system->mutex);
+
+		if (asset == NULL) return false;
+
+		if (asset->type->decode_fn) {
+
+			task_execute([asset]() { read_asset_staged(asset); }, NULL, true);
+		}
+		else {
+			
+			task_execute([asset]() {
+				load_asset_content(asset);
+				asset->ref_count.fetch_add(-1);
+			}, NULL, true);
+		}
+
+		return true;
 	}
 
 	SV_AUX bool load_asset_get_if_exists(AssetPtr& asset_ptr, const char* filepath)
 	{
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+		
 		Asset_internal** asset_ = asset_system->filepath_table.find(filepath);
 
 		if (asset_) {
@@ -378,20 +955,31 @@ namespace sv {
     {
 		if (filepath == nullptr) return false;
 
+		bool res = false;
+
 		switch (priority) {
 
 		case AssetLoadingPriority_RightNow:
-			return load_asset_right_now(asset_ptr, filepath);
+			res = load_asset_right_now(asset_ptr, filepath);
+			break;
 
 		case AssetLoadingPriority_KeepItLoading:
-			return load_asset_keep_it_loading(asset_ptr, filepath);
+			res = load_asset_keep_it_loading(asset_ptr, filepath);
+			break;
 
 		case AssetLoadingPriority_GetIfExists:
 			return load_asset_get_if_exists(asset_ptr, filepath);
 			
 		}
 
-		return false;
+		// The dependencies are written only by the loading thread, are read when the asset is loaded
+		if (res && current_loading_asset) {
+
+			AssetFilepath& dep = current_loading_asset->dependencies.emplace_back();
+			string_copy(dep.filepath, filepath, FILEPATH_SIZE + 1u);
+		}
+
+		return res;
     }
 
     void unload_asset(AssetPtr& asset_ptr)
@@ -405,6 +993,8 @@ namespace sv {
 			
 			Asset_internal* asset = reinterpret_cast<Asset_internal*>(asset_ptr.ptr);
 
+			SV_LOCK_GUARD(asset_system->mutex, lock);
+
 			name = string_validate(name);
 
 			if (!is_valid_asset_name(asset->type, name)) {
@@ -437,10 +1027,38 @@ namespace sv {
 
     void* get_asset_content(const AssetPtr& asset_ptr)
     {
-		if (asset_ptr.ptr) return reinterpret_cast<Asset_internal*>(asset_ptr.ptr) + 1u;
+		if (asset_ptr.ptr) {
+
+			Asset_internal* asset = reinterpret_cast<Asset_internal*>(asset_ptr.ptr);
+			
+			if (asset->state.load(std::memory_order_acquire) == AssetState_Loaded) {
+
+				// Written only once per frame to avoid the cache line sharing between threads
+				u64 frame = engine.frame_count;
+				if (asset->last_use.load(std::memory_order_relaxed) != frame)
+					asset->last_use.store(frame, std::memory_order_relaxed);
+				
+				return asset + 1u;
+			}
+		}
 		return nullptr;
     }
 
+	bool asset_is_loaded(const AssetPtr& asset_ptr)
+	{
+		return get_asset_content(asset_ptr) != NULL;
+	}
+
+	bool asset_is_loading(const AssetPtr& asset_ptr)
+	{
+		if (asset_ptr.ptr) {
+
+			Asset_internal* asset = reinterpret_cast<Asset_internal*>(asset_ptr.ptr);
+			return asset->state.load(std::memory_order_acquire) == AssetState_Loading;
+		}
+		return false;
+	}
+
     const char* get_asset_filepath(const AssetPtr& asset_ptr)
     {
 		if (asset_ptr.ptr) {
@@ -485,6 +1103,11 @@ namespace sv {
 		type->load_file_fn = desc->load_file_fn;
 		type->reload_file_fn = desc->reload_file_fn;
 		type->free_fn = desc->free_fn;
+		type->decode_fn = desc->decode_fn;
+		type->upload_fn = desc->upload_fn;
+		type->free_decoded_fn = desc->free_decoded_fn;
+		type->memory_fn = desc->memory_fn;
+		type->asset_size = desc->asset_size;
 		type->unused_time = desc->unused_time;
 
 		type->extension_count = desc->extension_count;
@@ -496,9 +1119,185 @@ namespace sv {
 			string_copy(type->extensions[i], ext, ASSET_EXTENSION_NAME_SIZE + 1u);
 		}
 
+		SV_ASSERT(type->decode_fn == NULL || type->upload_fn != NULL);
+
 		return true;
     }
 
+	void get_asset_load_stats(List<AssetLoadStats>& stats)
+	{
+		stats.reset();
+
+		for (AssetType_internal* type : asset_system->asset_types) {
+
+			AssetLoadStats& s = stats.emplace_back();
+			string_copy(s.name, type->name, ASSET_TYPE_NAME_SIZE + 1u);
+			s.load_count = type->load_count.load(std::memory_order_relaxed);
+			s.read_time = f64(type->read_time.load(std::memory_order_relaxed)) / 1000000.0;
+			s.decode_time = f64(type->decode_time.load(std::memory_order_relaxed)) / 1000000.0;
+			s.upload_time = f64(type->upload_time.load(std::memory_order_relaxed)) / 1000000.0;
+			s.load_time = f64(type->load_time.load(std::memory_order_relaxed)) / 1000000.0;
+		}
+	}
+
+	bool set_asset_budget(const char* type_name, u64 cpu_bytes, u64 gpu_bytes)
+	{
+		AssetType_internal* type = get_type_from_typename(type_name);
+		if (type == NULL) {
+			SV_LOG_ERROR("Asset type '%s' not found", type_name);
+			return false;
+		}
+
+		type->cpu_budget = cpu_bytes;
+		type->gpu_budget = gpu_bytes;
+		return true;
+	}
+
+	void set_asset_global_budget(u64 cpu_bytes, u64 gpu_bytes)
+	{
+		asset_system->cpu_budget = cpu_bytes;
+		asset_system->gpu_budget = gpu_bytes;
+	}
+
+	void get_asset_memory_stats(List<AssetMemoryStats>& stats, AssetMemoryStats* total)
+	{
+		stats.reset();
+
+		AssetMemoryStats t = {};
+		string_copy(t.name, "Total", ASSET_TYPE_NAME_SIZE + 1u);
+		t.cpu_budget = asset_system->cpu_budget;
+		t.gpu_budget = asset_system->gpu_budget;
+
+		for (AssetType_internal* type : asset_system->asset_types) {
+
+			AssetMemoryStats& s = stats.emplace_back();
+			string_copy(s.name, type->name, ASSET_TYPE_NAME_SIZE + 1u);
+			s.asset_count = type->resident_count.load(std::memory_order_relaxed);
+			s.cpu_bytes = type->cpu_bytes.load(std::memory_order_relaxed);
+			s.gpu_bytes = type->gpu_bytes.load(std::memory_order_relaxed);
+			s.cpu_budget = type->cpu_budget;
+			s.gpu_budget = type->gpu_budget;
+
+			t.asset_count += s.asset_count;
+			t.cpu_bytes += s.cpu_bytes;
+			t.gpu_bytes += s.gpu_bytes;
+		}
+
+		if (total) *total = t;
+	}
+
+	void asset_manifest_begin()
+	{
+		asset_system->manifest_stack.push_back(u32(asset_system->manifest_assets.size()));
+	}
+
+	SV_AUX bool manifest_contains(const List<Asset_internal*>& list, Asset_internal* asset)
+	{
+		for (Asset_internal* a : list)
+			if (a == asset) return true;
+		return false;
+	}
+
+	bool asset_manifest_end(const char* filepath)
+	{
+		SV_ASSERT(asset_system->manifest_stack.size());
+
+		u32 begin = asset_system->manifest_stack.back();
+		asset_system->manifest_stack.pop_back();
+
+		List<Asset_internal*> assets;
+
+		for (u32 i = begin; i < asset_system->manifest_assets.size(); ++i) {
+
+			Asset_internal* asset = asset_system->manifest_assets[i];
+			if (!manifest_contains(assets, asset))
+				assets.push_back(asset);
+		}
+
+		// The nested manifests are part of the parent
+		if (asset_system->manifest_stack.empty())
+			asset_system->manifest_assets.reset();
+
+		// Add the transitive dependencies
+		{
+			SV_LOCK_GUARD(asset_system->mutex, lock);
+			
+			for (u32 i = 0u; i < assets.size(); ++i) {
+
+				Asset_internal* asset = assets[i];
+
+				if (asset->state.load(std::memory_order_acquire) != AssetState_Loaded)
+					continue;
+
+				for (const AssetFilepath& dep : asset->dependencies) {
+
+					Asset_internal** d = asset_system->filepath_table.find(dep.filepath);
+					
+					if (d && !manifest_contains(assets, *d))
+						assets.push_back(*d);
+				}
+			}
+		}
+
+		Serializer s;
+		serialize_begin(s);
+
+		serialize_u32(s, 0u); // VERSION
+		serialize_u32(s, u32(assets.size()));
+
+		for (Asset_internal* asset : assets)
+			serialize_string(s, asset->filepath);
+
+		if (!serialize_end(s, filepath)) {
+			SV_LOG_ERROR("Can't save the asset manifest '%s'", filepath);
+			return false;
+		}
+
+		return true;
+	}
+
+	void _asset_manifest_add(const AssetPtr& asset_ptr)
+	{
+		if (asset_system->manifest_stack.empty() || asset_ptr.ptr == NULL)
+			return;
+
+		Asset_internal* asset = reinterpret_cast<Asset_internal*>(asset_ptr.ptr);
+
+		if (asset->filepath[0])
+			asset_system->manifest_assets.push_back(asset);
+	}
+
+	bool load_asset_manifest(const char* filepath, List<AssetPtr>& assets)
+	{
+		Deserializer d;
+
+		if (!deserialize_begin(d, filepath))
+			return false;
+
+		u32 version;
+		deserialize_u32(d, version);
+
+		u32 count;
+		deserialize_u32(d, count);
+
+		char path[FILEPATH_SIZE + 1u];
+
+		foreach(i, count) {
+
+			deserialize_string(d, path, FILEPATH_SIZE + 1u);
+
+			AssetPtr& asset_ptr = assets.emplace_back();
+
+			if (!load_asset_from_file(asset_ptr, path, AssetLoadingPriority_KeepItLoading)) {
+				SV_LOG_ERROR("Can't preload the asset '%s'", path);
+				assets.pop_back();
+			}
+		}
+
+		deserialize_end(d);
+		return true;
+	}
+
     void update_asset_files()
     {
 		SV_LOG("TODO");
@@ -506,6 +1305,8 @@ namespace sv {
 
     void free_unused_assets()
     {
+		SV_LOCK_GUARD(asset_system->mutex, lock);
+		
 		foreach(i, 4u) {
 
 			for (AssetType_internal* type : asset_system->asset_types) {
@@ -4,6 +4,7 @@
 #include "core/renderer.h"
 #include "core/particles.h"
 #include "core/event_system.h"
+#include "core/task_system.h"
 #include "core/physics3D.h"
 
 #include "platform/os.h"
@@ -72,17 +73,8 @@ namespace sv {
 		return true;
     }
 
-    SV_INTERNAL bool load_image_asset(void* asset, const char* name, const char* filepath)
+    SV_AUX bool create_image_from_pixels(GPUImage** image, void* data, u32 width, u32 height)
     {
-		GPUImage*& image = *reinterpret_cast<GPUImage**>(asset);
-
-		// Get file data
-		void* data;
-		u32 width;
-		u32 height;
-		if (!load_image(filepath, &data, &width, &height)) return false;
-
-		// Create Image
 		GPUImageDesc desc;
 
 		desc.data = data;
@@ -95,12 +87,59 @@ namespace sv {
 		desc.width = width;
 		desc.height = height;
 
-		bool res = graphics_image_create(&desc, &image);
+		return graphics_image_create(&desc, image);
+    }
+
+    SV_INTERNAL bool load_image_asset(void* asset, const char* name, const char* filepath)
+    {
+		GPUImage*& image = *reinterpret_cast<GPUImage**>(asset);
+
+		// Get file data
+		void* data;
+		u32 width;
+		u32 height;
+		if (!load_image(filepath, &data, &width, &height)) return false;
+
+		// Create Image
+		bool res = create_image_from_pixels(&image, data, width, height);
 
 		SV_FREE_MEMORY(data);
 		return res;
     }
 
+    struct DecodedImage {
+		void* data;
+		u32   width;
+		u32   height;
+    };
+
+    SV_INTERNAL void* decode_image_asset(const char* filepath, const u8* data, size_t size)
+    {
+		DecodedImage* image = SV_ALLOCATE_STRUCT(DecodedImage, "Image");
+
+		if (!load_image_from_memory(data, size, &image->data, &image->width, &image->height)) {
+			SV_FREE_STRUCT(image);
+			return NULL;
+		}
+		
+		return image;
+    }
+
+    SV_INTERNAL bool upload_image_asset(void* asset, const char* name, void* decoded)
+    {
+		GPUImage*& image = *reinterpret_cast<GPUImage**>(asset);
+		DecodedImage* d = reinterpret_cast<DecodedImage*>(decoded);
+		
+		return create_image_from_pixels(&image, d->data, d->width, d->height);
+    }
+
+    SV_INTERNAL void free_decoded_image(void* decoded)
+    {
+		DecodedImage* image = reinterpret_cast<DecodedImage*>(decoded);
+		SV_FREE_MEMORY(image->data);
+		SV_FREE_STRUCT(image);
+    }
+
     SV_INTERNAL bool destroy_image_asset(void* asset, const char* name)
     {
 		GPUImage*& image = *reinterpret_cast<GPUImage**>(asset);
@@ -115,6 +154,16 @@ namespace sv {
 		return load_image_asset(asset, name, filepath);
     }
 
+    SV_INTERNAL void image_asset_memory(void* asset, size_t* cpu_bytes, size_t* gpu_bytes)
+    {
+		GPUImage* image = *reinterpret_cast<GPUImage**>(asset);
+
+		if (image) {
+			const GPUImageInfo& info = graphics_image_info(image);
+			*gpu_bytes = size_t(info.width) * size_t(info.height) * 4u;
+		}
+    }
+
     SV_INTERNAL bool create_mesh_asset(void* asset, const char* name)
     {
 		Mesh* mesh = new(asset) Mesh();
@@ -147,6 +196,36 @@ namespace sv {
 		return true;
     }
 
+    // The buffers are created in the main thread, the graphics queue can't be used from the workers
+    SV_INTERNAL void* decode_mesh_asset(const char* filepath, const u8* data, size_t size)
+    {
+		Mesh* mesh = SV_ALLOCATE_STRUCT(Mesh, "Mesh");
+
+		if (!load_mesh(*mesh, filepath, data, size)) {
+			SV_FREE_STRUCT(mesh);
+			return NULL;
+		}
+
+		return mesh;
+    }
+
+    SV_INTERNAL bool upload_mesh_asset(void* asset, const char* name, void* decoded)
+    {
+		if (string_equals(name, "Cube") || string_equals(name, "Sphere")) {
+			SV_LOG_ERROR("Reserved mesh asset name: '%s'", name);
+			return false;
+		}
+
+		Mesh& mesh = *new(asset) Mesh(std::move(*reinterpret_cast<Mesh*>(decoded)));
+		return mesh_create_buffers(mesh);
+    }
+
+    SV_INTERNAL void free_decoded_mesh(void* decoded)
+    {
+		Mesh* mesh = reinterpret_cast<Mesh*>(decoded);
+		SV_FREE_STRUCT(mesh);
+    }
+
     SV_INTERNAL bool free_mesh_asset(void* asset, const char* name)
     {
 		Mesh& mesh = *reinterpret_cast<Mesh*>(asset);
@@ -154,6 +233,18 @@ namespace sv {
 		return true;
     }
 
+    SV_INTERNAL void mesh_asset_memory(void* asset, size_t* cpu_bytes, size_t* gpu_bytes)
+    {
+		Mesh& mesh = *reinterpret_cast<Mesh*>(asset);
+
+		*cpu_bytes = mesh.positions.size() * sizeof(v3_f32) + mesh.normals.size() * sizeof(v3_f32)
+			+ mesh.tangents.size() * sizeof(v4_f32) + mesh.texcoords.size() * sizeof(v2_f32)
+			+ mesh.indices.size() * sizeof(MeshIndex);
+
+		if (mesh.vbuffer) *gpu_bytes += graphics_buffer_info(mesh.vbuffer).size;
+		if (mesh.ibuffer) *gpu_bytes += graphics_buffer_info(mesh.ibuffer).size;
+    }
+
     SV_INTERNAL bool create_material_asset(void* asset, const char* name)
     {
 		new(asset) Material();
@@ -197,6 +288,10 @@ namespace sv {
 		desc.load_file_fn = load_image_asset;
 		desc.free_fn = destroy_image_asset;
 		desc.reload_file_fn = reload_image_asset;
+		desc.decode_fn = decode_image_asset;
+		desc.upload_fn = upload_image_asset;
+		desc.free_decoded_fn = free_decoded_image;
+		desc.memory_fn = image_asset_memory;
 		desc.unused_time = 3.f;
 
 		SV_CHECK(register_asset_type(&desc));
@@ -211,6 +306,10 @@ namespace sv {
 		desc.load_file_fn = load_mesh_asset;
 		desc.free_fn = free_mesh_asset;
 		desc.reload_file_fn = nullptr;
+		desc.decode_fn = decode_mesh_asset;
+		desc.upload_fn = upload_mesh_asset;
+		desc.free_decoded_fn = free_decoded_mesh;
+		desc.memory_fn = mesh_asset_memory;
 		desc.unused_time = 5.f;
 
 		SV_CHECK(register_asset_type(&desc));
@@ -225,6 +324,10 @@ namespace sv {
 		desc.load_file_fn = load_material_asset;
 		desc.free_fn = free_material_asset;
 		desc.reload_file_fn = nullptr;
+		desc.decode_fn = nullptr;
+		desc.upload_fn = nullptr;
+		desc.free_decoded_fn = nullptr;
+		desc.memory_fn = nullptr;
 		desc.unused_time = 2.5f;
 
 		SV_CHECK(register_asset_type(&desc));
@@ -259,7 +362,11 @@ namespace sv {
 		
 		_terrain_register_events();
 		_particle_initialize();
-		// TODO task_initialize();
+
+		if (!_task_initialize()) {
+			SV_LOG_ERROR("Can't initialize the task system");
+			return false;
+		}
 
 		// Initialize Graphics API
 		if (_graphics_initialize()) {
@@ -324,6 +431,9 @@ namespace sv {
     {
 		SV_LOG_INFO("Closing SilverEngine");
 
+		// Finish the pending tasks before closing the systems that they use
+		_task_close();
+
 		_particle_close();
 
 		_physics3D_close();
@@ -338,7 +448,6 @@ namespace sv {
 		_audio_close();
 		if (!_os_shutdown()) { SV_LOG_ERROR("Can't shutdown OS layer properly"); }
 		_close_assets();
-		// if (result_fail(task_close())) { SV_LOG_ERROR("Can't close the task system"); }
 
 		_event_close();
 
@@ -456,6 +565,8 @@ namespace sv {
 #else
 			_update_scene();
 #endif
+
+			_event_dispatch_posted();
 	    
 			// Draw editor and the console	    
 #if SV_EDITOR
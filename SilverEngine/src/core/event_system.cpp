@@ -2,10 +2,12 @@
 
 namespace sv {
 
+	// Only one of the functions is used
     struct EventRegister {
 		EventFn function;
+		EventBatchFn batch_function;
 		u32 flags;
-		u8 data[EVENT_REGISTER_DATA_SIZE];
+		u8* data; // Allocated with the register, the listener copies point to the same data
     };
 	
 	struct PluginFunction {
@@ -13,13 +15,77 @@ namespace sv {
 		Library library;
 	};
 
+#if SV_EDITOR
+	// Accumulated in the current frame and moved to last_* in _event_update
+	struct EventStats {
+		std::atomic<u32> calls = { 0u };
+		std::atomic<u64> time = { 0u }; // Nanoseconds
+		u32 last_calls = 0u;
+		u64 last_time = 0u;
+	};
+#endif
+
+	// Immutable copy of the listeners read by the dispatch, it is replaced as a whole when the listeners change
+	struct EventListeners {
+		List<EventRegister> registers;
+		List<PluginFunction> plugin_functions;
+#if SV_EDITOR
+		EventStats* stats; // Registers followed by the plugin functions
+		u32 stats_count;
+#endif
+	};
+
     struct EventType {
 		char name[EVENT_NAME_SIZE + 1u];
-		List<EventRegister> registers;
+		List<EventRegister> registers; // Protected by the mutex
 		List<PluginFunction> plugin_functions;
+		std::atomic<EventListeners*> listeners = { nullptr };
+		std::atomic<u32> post_size = { 0u }; // Size of the posted events, defined by the first post
 		Mutex mutex;
+#if SV_EDITOR
+		EventStats stats;
+#endif
     };
 
+	// The replaced listeners, the data of the removed registers and the old plugin libraries can be in use by a dispatch in other thread.
+	// They are released when all the dispatches started before the retirement are finished
+	struct RetiredResource {
+		EventListeners* listeners;
+		u8* register_data;
+		Library library;
+		char library_filepath[FILEPATH_SIZE + 1u]; // Copy of the library to remove, empty if there is no copy
+		u64 epoch;
+	};
+
+	struct PostedEvent {
+		EventType* type;
+		u32 offset;
+	};
+
+	// Linear arena with the events posted in a frame
+	struct EventPostBuffer {
+		List<PostedEvent> events;
+		List<u8> data;
+	};
+
+	// Double buffer of each thread. The owner posts in the active buffer without locks, the sync point flips the active
+	// index and only waits if the owner is still writing in the previous buffer
+	struct EventPostQueue {
+		EventPostBuffer   buffers[2];
+		std::atomic<u32>  active;
+		std::atomic<bool> writing;
+	};
+
+	struct PostedEventRef {
+		EventType* type;
+		const u8* data;
+		u32 order;
+		u32 group; // Order of the first post of the type
+	};
+
+	// One queue per task system thread, the last one is shared by the other threads
+	constexpr u32 EVENT_POST_BUFFER_COUNT = 32u;
+
 	struct PluginRegister {
 
 		char    name[PLUGIN_NAME_SIZE + 1u];
@@ -28,6 +94,7 @@ namespace sv {
 
 #if SV_EDITOR
 		Date last_write;
+		char library_filepath[FILEPATH_SIZE + 1u]; // Copy of the library, the original can be rebuilt while is loaded
 #endif
 		
 	};
@@ -39,20 +106,102 @@ namespace sv {
 
 		List<PluginRegister> plugins;
 
+		List<RetiredResource> retired;
+		Mutex retired_mutex;
+
+		// The dispatches count as readers of the current epoch. The epoch only advances when the readers of the previous one are finished
+		std::atomic<u64> epoch = { 0u };
+		std::atomic<u32> readers[2];
+
+		// The events posted during the delivery are sent in the next frame
+		EventPostQueue    post_queues[EVENT_POST_BUFFER_COUNT + 1u];
+		std::atomic<bool> foreign_post_lock = { false };
+		List<PostedEventRef> delivery_events;
+		List<u8> delivery_batch;
+
 #if SV_EDITOR
 		f32 update_plugins_time;
+		u32 plugin_copy_count;
+		std::atomic<bool> profiling = { false };
+		bool profiled_last_frame = false;
 #endif
 		
     };
 
     EventSystemState* event_system = nullptr;
 
+	SV_AUX void free_listeners(EventListeners* listeners)
+	{
+#if SV_EDITOR
+		SV_FREE_STRUCT_ARRAY(listeners->stats, listeners->stats_count);
+#endif
+		SV_FREE_STRUCT(listeners);
+	}
+
+	SV_AUX void free_retired_resource(RetiredResource& r)
+	{
+		if (r.listeners) free_listeners(r.listeners);
+		if (r.register_data) SV_FREE_MEMORY(r.register_data);
+
+		if (r.library) {
+			
+			library_free(r.library);
+			if (r.library_filepath[0]) file_remove(r.library_filepath);
+		}
+	}
+
+	SV_AUX void retire_resource(EventListeners* listeners, u8* register_data, Library library, const char* library_filepath)
+	{
+		SV_LOCK_GUARD(event_system->retired_mutex, lock);
+
+		RetiredResource& r = event_system->retired.emplace_back();
+		r.listeners = listeners;
+		r.register_data = register_data;
+		r.library = library;
+		string_copy(r.library_filepath, library_filepath ? library_filepath : "", FILEPATH_SIZE + 1u);
+		r.epoch = event_system->epoch.load();
+	}
+
+	// Returns the reader slot. If the epoch changes before the reader is counted the retired resources can be already released, so it tries again
+	SV_AUX u32 begin_event_read()
+	{
+		while (true) {
+
+			u64 epoch = event_system->epoch.load();
+			u32 slot = u32(epoch & 1u);
+
+			event_system->readers[slot].fetch_add(1u);
+
+			if (event_system->epoch.load() == epoch)
+				return slot;
+
+			event_system->readers[slot].fetch_sub(1u);
+		}
+	}
+
+	SV_AUX void end_event_read(u32 slot)
+	{
+		event_system->readers[slot].fetch_sub(1u, std::memory_order_release);
+	}
+
     bool _event_initialize()
     {
 		event_system = SV_ALLOCATE_STRUCT(EventSystemState, "EventSystem");
 		
 		SV_CHECK(mutex_create(event_system->global_mutex));
+		SV_CHECK(mutex_create(event_system->retired_mutex));
+
+		foreach(i, EVENT_POST_BUFFER_COUNT + 1u) {
+			event_system->post_queues[i].active.store(0u);
+			event_system->post_queues[i].writing.store(false);
+		}
+		
+		event_system->readers[0].store(0u);
+		event_system->readers[1].store(0u);
 		event_system->update_plugins_time = 0.f;
+#if SV_EDITOR
+		event_system->plugin_copy_count = 0u;
+#endif
 	    
 		return true;
     }
@@ -62,11 +211,21 @@ namespace sv {
 		if (event_system) {
 
 			mutex_destroy(event_system->global_mutex);
+			mutex_destroy(event_system->retired_mutex);
 
 			for (EventType& t : event_system->table) {
 				mutex_destroy(t.mutex);
+
+				EventListeners* listeners = t.listeners.load();
+				if (listeners) free_listeners(listeners);
+
+				for (EventRegister& reg : t.registers)
+					SV_FREE_MEMORY(reg.data);
 			}
 
+			for (RetiredResource& r : event_system->retired)
+				free_retired_resource(r);
+
 			SV_FREE_STRUCT(event_system);
 			event_system = nullptr;
 		}
@@ -74,6 +233,63 @@ namespace sv {
 		return true;
     }
 
+	// Must be called with the type mutex locked
+	SV_AUX void publish_listeners(EventType& type)
+	{
+		EventListeners* listeners = NULL;
+
+		if (type.registers.size() || type.plugin_functions.size()) {
+			
+			listeners = SV_ALLOCATE_STRUCT(EventListeners, "EventSystem");
+			listeners->registers = type.registers;
+			listeners->plugin_functions = type.plugin_functions;
+#if SV_EDITOR
+			listeners->stats_count = u32(type.registers.size() + type.plugin_functions.size());
+			listeners->stats = SV_ALLOCATE_STRUCT_ARRAY(EventStats, listeners->stats_count, "EventSystem");
+#endif
+		}
+
+		EventListeners* old = type.listeners.exchange(listeners);
+
+		if (old) retire_resource(old, NULL, 0, NULL);
+	}
+
+	SV_AUX void free_retired_resources()
+	{
+		SV_LOCK_GUARD(event_system->retired_mutex, lock);
+
+		u64 epoch = event_system->epoch.load();
+
+		// The readers of the previous epochs are finished, the resources retired before the current epoch can't be referenced
+		if (event_system->readers[(epoch - 1u) & 1u].load(std::memory_order_acquire) != 0u)
+			return;
+
+		List<RetiredResource>& retired = event_system->retired;
+		u32 count = 0u;
+
+		// Sorted by epoch
+		while (count < retired.size() && retired[count].epoch < epoch) {
+			free_retired_resource(retired[count]);
+			++count;
+		}
+
+		if (count) {
+			foreach(i, retired.size() - count)
+				retired[i] = retired[i + count];
+			retired.pop_back(count);
+		}
+
+		event_system->epoch.store(epoch + 1u);
+	}
+
+#if SV_EDITOR
+	// Each copy has a different name, the previous one is loaded until the dispatches that can use it are finished
+	SV_AUX void plugin_copy_filepath(char* dst, const char* filepath)
+	{
+		sprintf(dst, "$system/bin/%u_%s", event_system->plugin_copy_count++, filepath_name(filepath));
+	}
+#endif
+
 	SV_AUX void update_plugin_functions_type(EventType& type, PluginRegister* reg, Library old_lib)
 	{			
 		if (old_lib) {
@@ -96,6 +312,8 @@ namespace sv {
 			if (p.function != NULL)
 				type.plugin_functions.push_back(p);
 		}
+
+		publish_listeners(type);
 	}
 
 	SV_AUX void update_plugin_functions(PluginRegister* reg, Library old_lib)
@@ -112,8 +330,55 @@ namespace sv {
 		mutex_unlock(event_system->global_mutex);
 	}
 
+#if SV_EDITOR
+	SV_AUX void add_event_stats(EventStats& stats, u32 calls, f64 t0)
+	{
+		stats.calls.fetch_add(calls, std::memory_order_relaxed);
+		stats.time.fetch_add(u64((timer_now() - t0) * 1000000000.0), std::memory_order_relaxed);
+	}
+
+	SV_AUX void end_event_stats(EventStats& stats)
+	{
+		stats.last_calls = stats.calls.exchange(0u, std::memory_order_relaxed);
+		stats.last_time = stats.time.exchange(0u, std::memory_order_relaxed);
+	}
+
+	// Runs in the main thread at the begining of the frame
+	SV_AUX void end_frame_profiling()
+	{
+		bool profiling = event_system->profiling.load();
+		
+		if (!profiling && !event_system->profiled_last_frame)
+			return;
+
+		event_system->profiled_last_frame = profiling;
+
+		SV_LOCK_GUARD(event_system->global_mutex, lock);
+		u32 slot = begin_event_read();
+		
+		for (EventType& type : event_system->table) {
+
+			end_event_stats(type.stats);
+
+			EventListeners* listeners = type.listeners.load(std::memory_order_acquire);
+
+			if (listeners) {
+				foreach(i, listeners->stats_count)
+					end_event_stats(listeners->stats[i]);
+			}
+		}
+
+		end_event_read(slot);
+	}
+#endif
+
 	void _event_update()
 	{
+		free_retired_resources();
+
+#if SV_EDITOR
+		end_frame_profiling();
+#endif
 		
 #if SV_EDITOR
 		event_system->update_plugins_time += engine.deltatime;
@@ -128,12 +393,9 @@ namespace sv {
 
 					if (last_write != reg.last_write) {
 
-						char filepath[FILEPATH_SIZE + 1u] = "$system/bin/";
-						string_append(filepath, filepath_name(reg.filepath), FILEPATH_SIZE + 1u);
-					
-						if (reg.library) {
-							library_free(reg.library);
-						}
+						// The old library is loaded until the dispatches that can call its functions are finished
+						char filepath[FILEPATH_SIZE + 1u];
+						plugin_copy_filepath(filepath, reg.filepath);
 
 						if (file_copy(reg.filepath, filepath)) {
 
@@ -147,6 +409,9 @@ namespace sv {
 							reg.last_write = last_write;
 							update_plugin_functions(&reg, last_library);
 
+							if (last_library) retire_resource(NULL, NULL, last_library, reg.library_filepath);
+							string_copy(reg.library_filepath, filepath, FILEPATH_SIZE + 1u);
+
 							ReloadPluginEvent e;
 							string_copy(e.name, reg.name, PLUGIN_NAME_SIZE + 1u);
 							e.library = reg.library;
@@ -182,8 +447,8 @@ namespace sv {
 		const char* original_filepath = filepath;
 		
 #if SV_EDITOR
-		char aux_filepath[FILEPATH_SIZE + 1u] = "$system/bin/";
-		string_append(aux_filepath, filepath_name(filepath), FILEPATH_SIZE + 1u);
+		char aux_filepath[FILEPATH_SIZE + 1u];
+		plugin_copy_filepath(aux_filepath, filepath);
 		
 		if (!file_copy(filepath, aux_filepath)) {
 			SV_LOG_ERROR("Can't copy the dynamic library '%s'", filepath);
@@ -206,7 +471,8 @@ namespace sv {
 		SV_LOG_INFO("Plugin registred '%s'", name);
 
 #if SV_EDITOR		
-		file_date(filepath, NULL, &reg.last_write, NULL);
+		file_date(original_filepath, NULL, &reg.last_write, NULL);
+		string_copy(reg.library_filepath, filepath, FILEPATH_SIZE + 1u);
 #endif
 
 		update_plugin_functions(&reg, NULL);
@@ -221,7 +487,6 @@ namespace sv {
 		for (PluginRegister& reg : event_system->plugins) {
 
 			Library old_lib = reg.library;
-			library_free(reg.library);
 
 			for (EventType& type : event_system->table) {
 
@@ -229,6 +494,14 @@ namespace sv {
 				update_plugin_functions_type(type, NULL, old_lib);
 				mutex_unlock(type.mutex);
 			}
+
+			if (old_lib) {
+#if SV_EDITOR
+				retire_resource(NULL, NULL, old_lib, reg.library_filepath);
+#else
+				retire_resource(NULL, NULL, old_lib, NULL);
+#endif
+			}
 		}
 
 		event_system->plugins.clear();
@@ -285,10 +558,21 @@ namespace sv {
 		return type;
     }
 
+	// The type isn't erased, the handles must be valid while the event system is alive
     void event_unregister_all(const char* event_name)
     {
-		SV_LOCK_GUARD(event_system->global_mutex, lock);
-		event_system->table.erase(event_name);
+		EventType* type = find_type(event_name, false);
+
+		if (type) {
+			
+			SV_LOCK_GUARD(type->mutex, lock);
+
+			for (EventRegister& reg : type->registers)
+				retire_resource(NULL, reg.data, 0, NULL);
+			
+			type->registers.clear();
+			publish_listeners(*type);
+		}
     }
 
 	SV_AUX EventType& find_and_create_type(const char* event_name)
@@ -307,7 +591,7 @@ namespace sv {
 		return type;
 	}
     
-    bool _event_register(const char* event_name, EventFn event, u32 flags, void* data, u32 data_size)
+    SV_AUX bool add_register(const char* event_name, EventFn event, EventBatchFn batch_event, u32 flags, void* data, u32 data_size)
     {
 		size_t event_name_size = strlen(event_name);
 
@@ -330,7 +614,7 @@ namespace sv {
 
 			for (const EventRegister& reg : type.registers) {
 
-				if (reg.function == event) {
+				if (reg.function == event && reg.batch_function == batch_event) {
 					SV_LOG_ERROR("Duplicated event register in '%s'", event_name);
 					return false;
 				}
@@ -338,17 +622,31 @@ namespace sv {
 
 			EventRegister& reg = type.registers.emplace_back();
 			reg.function = event;
+			reg.batch_function = batch_event;
 			reg.flags = flags;
+			reg.data = (u8*)SV_ALLOCATE_MEMORY(EVENT_REGISTER_DATA_SIZE, "EventSystem");
 			SV_ZERO_MEMORY(reg.data, EVENT_REGISTER_DATA_SIZE);
 			
 			if (data) {
 				memcpy(reg.data, data, data_size);
 			}
+
+			publish_listeners(type);
 		}
 
 		return true;
     }
     
+    bool _event_register(const char* event_name, EventFn event, u32 flags, void* data, u32 data_size)
+    {
+		return add_register(event_name, event, NULL, flags, data, data_size);
+    }
+
+    bool _event_register_batch(const char* event_name, EventBatchFn event, u32 flags, void* data, u32 data_size)
+    {
+		return add_register(event_name, NULL, event, flags, data, data_size);
+    }
+    
     bool _event_unregister(const char* event_name, EventFn event)
     {
 		EventType* type = find_type(event_name, true);
@@ -362,8 +660,10 @@ namespace sv {
 
 				const EventRegister& reg = type->registers[i];
 
-				if (reg.function == event) {
+				if (reg.function == event || (void*)reg.batch_function == (void*)event) {
+					retire_resource(NULL, reg.data, 0, NULL);
 					type->registers.erase(i);
+					publish_listeners(*type);
 					return false;
 				}
 			}
@@ -372,22 +672,330 @@ namespace sv {
 		return true;
     }
     
-    void event_dispatch(const char* event_name, void* data)
-    {
-		mutex_lock(event_system->global_mutex);
-		EventType& type = find_and_create_type(event_name);
-		mutex_unlock(event_system->global_mutex);
+	EventHandle event_handle(const char* event_name)
+	{
+		size_t event_name_size = strlen(event_name);
 
-		SV_LOCK_GUARD(type.mutex, lock);
+		if (event_name_size > EVENT_NAME_SIZE) {
+			SV_LOG_ERROR("The event name '%s' exceeds the max name size '%u'", event_name, event_name_size);
+			return NULL;
+		}
+		
+		SV_LOCK_GUARD(event_system->global_mutex, lock);
+		return &find_and_create_type(event_name);
+	}
+
+	SV_AUX void dispatch_listeners(EventHandle handle, EventListeners* listeners, void* data)
+	{
+#if SV_EDITOR
+		if (event_system->profiling.load(std::memory_order_relaxed)) {
+
+			f64 begin = timer_now();
+			u32 index = 0u;
+			
+			for (EventRegister& reg : listeners->registers) {
+
+				f64 t0 = timer_now();
+				
+				if (reg.function) reg.function(data, reg.data);
+				else reg.batch_function(data, 1u, reg.data);
+
+				add_event_stats(listeners->stats[index++], 1u, t0);
+			}
+			for (PluginFunction& reg : listeners->plugin_functions) {
+
+				f64 t0 = timer_now();
+				reg.function(data, NULL);
+				add_event_stats(listeners->stats[index++], 1u, t0);
+			}
+
+			add_event_stats(handle->stats, 1u, begin);
+			return;
+		}
+#endif
 		
-		for (EventRegister& reg : type.registers) {
+		for (EventRegister& reg : listeners->registers) {
 
-			reg.function(data, reg.data);
+			if (reg.function) reg.function(data, reg.data);
+			else reg.batch_function(data, 1u, reg.data);
 		}
-		for (PluginFunction& reg : type.plugin_functions) {
+		for (PluginFunction& reg : listeners->plugin_functions) {
 
 			reg.function(data, NULL);
 		}
+	}
+
+	// Lock free, the listeners are replaced with a new array when they change
+	void event_dispatch(EventHandle handle, void* data)
+	{
+		if (handle == NULL) return;
+
+		u32 slot = begin_event_read();
+		
+		EventListeners* listeners = handle->listeners.load(std::memory_order_acquire);
+		if (listeners) dispatch_listeners(handle, listeners, data);
+
+		end_event_read(slot);
+	}
+
+	bool event_post(EventHandle handle, const void* data, u32 size)
+	{
+		if (handle == NULL) return false;
+
+		u32 expected = 0u;
+		if (!handle->post_size.compare_exchange_strong(expected, size) && expected != size) {
+			SV_LOG_ERROR("The event '%s' is posted with size %u, the previous size is %u", handle->name, size, expected);
+			return false;
+		}
+
+		u32 thread = task_thread_index();
+		bool foreign = thread >= EVENT_POST_BUFFER_COUNT;
+
+		// The threads without queue share the last one, they are serialized with a spin lock
+		if (foreign) {
+
+			thread = EVENT_POST_BUFFER_COUNT;
+
+			bool locked = false;
+			while (!event_system->foreign_post_lock.compare_exchange_weak(locked, true, std::memory_order_acquire)) {
+				locked = false;
+				thread_yield();
+			}
+		}
+
+		EventPostQueue& queue = event_system->post_queues[thread];
+
+		// Pairs with the flip of _event_dispatch_posted, the active index is read after notifying the write
+		queue.writing.store(true);
+		EventPostBuffer& buffer = queue.buffers[queue.active.load()];
+
+		// Keep the events aligned
+		u32 offset = u32(buffer.data.size());
+		buffer.data.resize(offset + ((size + 15u) & ~15u));
+		memcpy(buffer.data.data() + offset, data, size);
+
+		PostedEvent& e = buffer.events.emplace_back();
+		e.type = handle;
+		e.offset = offset;
+
+		queue.writing.store(false, std::memory_order_release);
+
+		if (foreign) event_system->foreign_post_lock.store(false, std::memory_order_release);
+
+		return true;
+	}
+
+	void _event_dispatch_posted()
+	{
+		List<PostedEventRef>& events = event_system->delivery_events;
+		List<u8>& batch = event_system->delivery_batch;
+
+		events.reset();
+		
+		foreach(i, EVENT_POST_BUFFER_COUNT + 1u) {
+
+			EventPostQueue& queue = event_system->post_queues[i];
+			
+			u32 active = queue.active.load();
+
+			// The buffer delivered in the last frame receives the new posts
+			EventPostBuffer& post = queue.buffers[active ^ 1u];
+			post.events.reset();
+			post.data.reset();
+			
+			queue.active.store(active ^ 1u);
+
+			// The owner can be finishing a post in the previous buffer
+			while (queue.writing.load())
+				thread_yield();
+
+			EventPostBuffer& delivery = queue.buffers[active];
+
+			for (const PostedEvent& e : delivery.events) {
+
+				PostedEventRef& ref = events.emplace_back();
+				ref.type = e.type;
+				ref.data = delivery.data.data() + e.offset;
+				ref.order = u32(events.size());
+			}
+		}
+
+		if (events.empty()) return;
+
+		bool profiling = false;
+#if SV_EDITOR
+		profiling = event_system->profiling.load(std::memory_order_relaxed);
+#endif
+
+		// Group by type keeping the post order
+		std::sort(events.data(), events.data() + events.size(), [](const PostedEventRef& e0, const PostedEventRef& e1) {
+			if (e0.type != e1.type) return e0.type < e1.type;
+			return e0.order < e1.order;
+		});
+
+		// The groups are sent in the order of the first post of each type, not in the order of the addresses
+		foreach(i, events.size()) {
+			events[i].group = (i != 0u && events[i - 1u].type == events[i].type) ? events[i - 1u].group : events[i].order;
+		}
+
+		std::sort(events.data(), events.data() + events.size(), [](const PostedEventRef& e0, const PostedEventRef& e1) {
+			if (e0.group != e1.group) return e0.group < e1.group;
+			return e0.order < e1.order;
+		});
+
+		u32 slot = begin_event_read();
+		u32 begin = 0u;
+
+		while (begin < events.size()) {
+
+			EventType* type = events[begin].type;
+			u32 end = begin + 1u;
+
+			while (end < events.size() && events[end].type == type)
+				++end;
+
+			EventListeners* listeners = type->listeners.load(std::memory_order_acquire);
+
+			if (listeners) {
+
+				u32 size = type->post_size.load();
+				u32 count = end - begin;
+				bool contiguous = false;
+
+				f64 type_t0 = profiling ? timer_now() : 0.0;
+				u32 index = 0u;
+				
+				for (EventRegister& reg : listeners->registers) {
+
+					f64 t0 = profiling ? timer_now() : 0.0;
+
+					if (reg.function) {
+						
+						for (u32 i = begin; i < end; ++i)
+							reg.function((void*)events[i].data, reg.data);
+					}
+					else {
+
+						if (!contiguous) {
+
+							batch.resize(size_t(size) * size_t(count));
+
+							for (u32 i = begin; i < end; ++i)
+								memcpy(batch.data() + size_t(i - begin) * size_t(size), events[i].data, size);
+							
+							contiguous = true;
+						}
+						
+						reg.batch_function(batch.data(), count, reg.data);
+					}
+
+#if SV_EDITOR
+					if (profiling) add_event_stats(listeners->stats[index], reg.function ? count : 1u, t0);
+#endif
+					++index;
+				}
+				for (PluginFunction& reg : listeners->plugin_functions) {
+
+					f64 t0 = profiling ? timer_now() : 0.0;
+					
+					for (u32 i = begin; i < end; ++i)
+						reg.function((void*)events[i].data, NULL);
+
+#if SV_EDITOR
+					if (profiling) add_event_stats(listeners->stats[index], count, t0);
+#endif
+					++index;
+				}
+
+#if SV_EDITOR
+				if (profiling) add_event_stats(type->stats, count, type_t0);
+#endif
+			}
+
+			begin = end;
+		}
+
+		end_event_read(slot);
+	}
+    
+    void event_dispatch(const char* event_name, void* data)
+    {
+		event_dispatch(event_handle(event_name), data);
     }
 
+#if SV_EDITOR
+
+	void event_profiling_enable(bool enable)
+	{
+		event_system->profiling.store(enable);
+	}
+
+	bool event_profiling_enabled()
+	{
+		return event_system->profiling.load();
+	}
+
+	void event_profile_get(List<EventProfile>& profiles)
+	{
+		profiles.reset();
+
+		SV_LOCK_GUARD(event_system->global_mutex, lock);
+		u32 slot = begin_event_read();
+
+		for (EventType& type : event_system->table) {
+
+			EventListeners* listeners = type.listeners.load(std::memory_order_acquire);
+
+			if (type.stats.last_calls == 0u || listeners == NULL)
+				continue;
+
+			EventProfile& p = profiles.emplace_back();
+			string_copy(p.name, type.name, EVENT_NAME_SIZE + 1u);
+			p.calls = type.stats.last_calls;
+			p.time = f64(type.stats.last_time) / 1000000.0;
+
+			u32 index = 0u;
+
+			for (const EventRegister& reg : listeners->registers) {
+
+				const EventStats& stats = listeners->stats[index++];
+				
+				EventListenerProfile& l = p.listeners.emplace_back();
+				l.function = reg.function ? (void*)reg.function : (void*)reg.batch_function;
+				l.plugin[0] = '\0';
+				l.calls = stats.last_calls;
+				l.time = f64(stats.last_time) / 1000000.0;
+			}
+			for (const PluginFunction& reg : listeners->plugin_functions) {
+
+				const EventStats& stats = listeners->stats[index++];
+				
+				EventListenerProfile& l = p.listeners.emplace_back();
+				l.function = (void*)reg.function;
+				l.plugin[0] = '\0';
+				l.calls = stats.last_calls;
+				l.time = f64(stats.last_time) / 1000000.0;
+
+				for (const PluginRegister& plugin : event_system->plugins) {
+					if (plugin.library == reg.library) {
+						string_copy(l.plugin, plugin.name, PLUGIN_NAME_SIZE + 1u);
+						break;
+					}
+				}
+			}
+
+			std::sort(p.listeners.data(), p.listeners.data() + p.listeners.size(), [](const EventListenerProfile& l0, const EventListenerProfile& l1) {
+				return l0.time > l1.time;
+			});
+		}
+
+		end_event_read(slot);
+
+		std::sort(profiles.data(), profiles.data() + profiles.size(), [](const EventProfile& p0, const EventProfile& p1) {
+			return p0.time > p1.time;
+		});
+	}
+
+#endif
+
 }
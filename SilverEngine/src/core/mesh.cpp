@@ -1553,11 +1553,13 @@ namespace sv {
 		return true;
 	}
 
-    bool load_mesh(Mesh& mesh, const char* filepath)
+    bool load_mesh(Mesh& mesh, const char* filepath, const u8* data, size_t size)
     {
 		Deserializer d;
 
-		if (deserialize_begin(d, filepath)) {
+		bool opened = data ? deserialize_begin(d, data, size) : deserialize_begin(d, filepath);
+
+		if (opened) {
 
 			u32 version;
 			deserialize_u32(d, version);
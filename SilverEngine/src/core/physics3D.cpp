@@ -66,7 +66,7 @@ namespace sv {
 					e.entity0 = (Entity)e.body0->id;
 					e.entity1 = (Entity)e.body1->id;
 					
-					event_dispatch("on_body_collision", &e);
+					event_dispatch(physics->on_body_collision, &e);
 				}
 			}
 		}
@@ -110,6 +110,8 @@ namespace sv {
 		PxScene* scene = NULL;
 
 		PxMaterial* default_material = NULL;
+
+		EventHandle on_body_collision = NULL;
 	};
 
 	static Physics3DData* physics = NULL;
@@ -117,6 +119,7 @@ namespace sv {
 	bool _physics3D_initialize()
 	{
 		physics = SV_ALLOCATE_STRUCT(Physics3DData, "Physx");
+		physics->on_body_collision = event_handle("on_body_collision");
 		
 		physics->foundation = PxCreateFoundation(PX_PHYSICS_VERSION, physics->allocator, physics->error_callback);
 
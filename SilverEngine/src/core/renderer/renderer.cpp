@@ -1305,7 +1305,7 @@ namespace sv {
 					inst.emissive_color = Color::Black();
 					inst.layer = spr.layer;
 				}
-				foreach_component(animated_sprite_id, it, 0) {
+				foreach_component(animated_sprite_id, it, CompItFlag_Write) {
 			
 					AnimatedSpriteComponent& s = *(AnimatedSpriteComponent*)it.comp;
 					Entity entity = it.entity;
@@ -1404,12 +1404,11 @@ namespace sv {
 				CompID ps_model_id = get_component_id("Particle System Model");
 				CompID ps_id = get_component_id("Particle System");
 				
-				foreach_component(ps_model_id, it, 0) {
+				// The particle systems are simulated when are drawn
+				foreach_query_write(it, 0u, SV_BIT(ps_id), ps_model_id, ps_id) {
 					
-					ParticleSystemModel& psm = *(ParticleSystemModel*)it.comp;
-					ParticleSystem* ps = (ParticleSystem*)get_entity_component(it.entity, ps_id);
-
-					if (ps == NULL) continue;
+					ParticleSystemModel& psm = *(ParticleSystemModel*)it.comps[0];
+					ParticleSystem* ps = (ParticleSystem*)it.comps[1];
 
 					ParticlesInstance& inst = particles_instances.emplace_back();
 					inst.position = get_entity_world_position(it.entity);
@@ -4,14 +4,17 @@
 #include "core/physics3D.h"
 #include "core/sound_system.h"
 #include "debug/console.h"
+#include "core/task_system.h"
 
 #define SV_SCENE() sv::Scene& scene = *scene_state->scene
 #define SV_ECS() SV_SCENE(); sv::ECS& ecs = scene.ecs
 
 namespace sv {
 
+	// Sparse set, the entity membership is stored in the entity tag mask
 	struct TagInternal {
 		List<Entity> entities;
+		List<u32>    sparse; // Position in the entities list, indexed by entity
 	};
 
 	struct TagRegister {
@@ -28,6 +31,8 @@ namespace sv {
 		
 	};
 
+	struct EntityMirrorBlock;
+
 	struct EntityInternal {
 		
 		// TODO: Should move this to other pool??
@@ -36,12 +41,34 @@ namespace sv {
 		CompRef components[ENTITY_COMPONENTS_MAX];
 		u64 tag_mask;
 		
+		// Position in entity_hierarchy and number of childs (recursive). Valid when the hierarchy isn't dirty,
+		// the hierarchy_index is u32_max if the entity doesn't exist
 		u32 hierarchy_index;
-		Entity parent;
 		u32 child_count;
+
+		Entity parent;
+		Entity first_child;
+		Entity last_child;
+		Entity next_sibling;
+		Entity prev_sibling;
+		
 		Entity prefab;
 
 		EntityPrefab* own_prefab;
+
+		// Allocated the first time that a mirror of the instance is used
+		EntityMirrorBlock* mirrors;
+
+		// Spatial index cell (0 if isn't indexed) and position in the cell
+		u64  spatial_cell;
+		u32  spatial_index;
+		bool spatial_dirty;
+
+		u32 archetype;
+		u32 archetype_row;
+
+		// Incremented when the entity is destroyed, it isn't reset when the slot is reused
+		u32 generation;
 		
 	};
 
@@ -54,18 +81,18 @@ namespace sv {
 		
 	};
 
-	struct EntityTransform {
+	struct EntityLocalTransform {
+		v3_f32 position;
+		v3_f32 scale;
+		v4_f32 rotation;
+	};
+
+	struct EntityTransform : EntityLocalTransform {
 
 		// World space
 
 		XMFLOAT4X4 world_matrix;
 
-		// Local space
-		
-		v3_f32 position;
-		v3_f32 scale;
-		v4_f32 rotation;
-
 		bool dirty;
 
 		// Used to know if the physics engine should update the transform
@@ -73,16 +100,20 @@ namespace sv {
 		
 	};
 
-	// TODO: Use this insted of compute every time the matrices of a mirror
-	struct EntityMirrorTransform {
-
-		XMFLOAT4X4 world_matrix;
-		
-		bool dirty;
+	// Local transform of a mirror that replaces the transform of the prefab child.
+	// Uses the prefab child entity, the mirror indices change with the prefab hierarchy
+	struct EntityMirrorOverride {
+		Entity               child;
+		EntityLocalTransform transform;
+	};
 
-		// Used to know if the physics engine should update the transform
-		bool dirty_physics;
-		
+	// Per instance data of the prefab mirrors. The components and the transforms of the prefab childs are shared,
+	// the instance only stores the overrides and the matrix that moves the prefab childs to the instance
+	struct EntityMirrorBlock {
+		List<EntityMirrorOverride> overrides;
+		XMFLOAT4X4                 relative_matrix; // inverse(prefab world) * instance world
+		u32                        version;
+		bool                       dirty;
 	};
 
 	struct ComponentPool {
@@ -92,18 +123,121 @@ namespace sv {
 		u32 free_count;
 	};
 
+	// Each pool doubles the capacity of the previous one, the pools are never moved
+	constexpr u32 COMPONENT_POOL_BASE_CAPACITY = 16u;
+	constexpr u32 COMPONENT_POOL_MAX = 24u;
+
+	struct ComponentRemoval {
+		Entity entity;
+		u64    frame;
+	};
+
 	struct ComponentAllocator {
 
-		ComponentPool* pools;
-		u32            pool_count;
+		ComponentPool pools[COMPONENT_POOL_MAX];
+		u32           pool_count;
+
+		// Intrusive list of vacant slots. Stores the slot index + 1 (0 is the end of the list),
+		// the next vacant slot is stored in the flags of the free component
+		u32           free_list;
+
+		// Archetypes that contain this component
+		List<u32>      archetypes;
+
+		// Sorted by frame, the old ones are removed in the scene update
+		List<ComponentRemoval> removals;
 		
 	};
 
+	constexpr u32 ARCHETYPE_CHUNK_SIZE = 16u * 1024u;
+
+	struct ArchetypeColumn {
+		CompID comp_id;
+		u32    offset;
+		u32    stride;
+		// Stores the component data or a pointer to the component pool
+		bool   is_inline;
+	};
+
+	// Entities with the same component mask. The rows are stored in chunks of ARCHETYPE_CHUNK_SIZE bytes,
+	// each chunk contains an array of entities followed by an array for each column
+	struct Archetype {
+		u64             mask;
+		ArchetypeColumn columns[ENTITY_COMPONENTS_MAX];
+		u32             column_count;
+		u32             chunk_capacity;
+		u32             chunk_size;
+		u32             count;
+		List<u8*>       chunks;
+		List<u64>       versions; // Frame of the last change of each column, indexed by chunk * column_count + column
+	};
+
+	struct QueryMatch {
+		u32 archetype;
+		u8  columns[QUERY_COMPONENTS_MAX];
+	};
+
+	// Archetypes are never removed while the scene is alive, so the cache only checks the archetypes created after the last query
+	struct QueryCache {
+		CompID           comp_ids[QUERY_COMPONENTS_MAX];
+		u32              comp_count;
+		u64              exclude_mask;
+		List<QueryMatch> matches;
+		u32              archetype_count;
+	};
+
+	struct SpatialEntry {
+		Entity entity;
+		v3_f32 center;
+		f32    radius;
+	};
+
+	// The bounds contain all the spheres of the cell, they shrink when an entry is removed and the empty cells are erased
+	struct SpatialCell {
+		List<SpatialEntry> entries;
+		v3_f32             min;
+		v3_f32             max;
+	};
+
+	// Loose grid: the entities are stored in the cell of the center, the radius can't be bigger than half cell
+	constexpr f32 SPATIAL_CELL_SIZE = 8.f;
+	constexpr u64 SPATIAL_CELL_LARGE = 1u;
+
+	enum EntityCommandType : u32 {
+		EntityCommandType_CreateEntity,
+		EntityCommandType_DestroyEntity,
+		EntityCommandType_AddComponent,
+		EntityCommandType_RemoveComponent,
+		EntityCommandType_SetComponent,
+	};
+
+	struct EntityCommand {
+		EntityCommandType type;
+		Entity            entity;
+		Entity            parent;
+		Entity            prefab;
+		CompID            comp_id;
+		u32               data; // Offset of the entity name or the component copy, u32_max if there is no data
+	};
+
+	struct EntityCommandBuffer {
+		List<EntityCommand> commands;
+		List<u8>            data;
+		List<Entity>        created; // Entities created in the playback, indexed by the deferred entity id
+		u32                 create_count;
+	};
+
+	// The deferred entities use the top byte (mirrors use the values below), then the thread index and the creation index
+	constexpr Entity DEFERRED_ENTITY_MASK = 0xFF000000;
+	constexpr u32    DEFERRED_ENTITY_MAX = 0xFFFF;
+
 	typedef void(*CreateComponentFn)(Component*, Entity entity);
     typedef void(*DestroyComponentFn)(Component*, Entity entity);
     typedef void(*CopyComponentFn)(Component* dst, const Component* src, Entity entity);
     typedef void(*SerializeComponentFn)(Component* comp, Serializer& serializer);
     typedef void(*DeserializeComponentFn)(Component* comp, Deserializer& deserializer, u32 version);
+	// Constructs a copy in uninitialized memory, used by the snapshots
+	typedef void(*SnapshotComponentFn)(Component* dst, const Component* src);
 
 	struct ComponentRegister {
 
@@ -115,8 +249,10 @@ namespace sv {
 		CopyComponentFn		   copy_fn;
 		SerializeComponentFn   serialize_fn;
 		DeserializeComponentFn deserialize_fn;
+		SnapshotComponentFn    snapshot_fn; // NULL if the snapshots use the serialization
 		Library                library;
 		char		           struct_name[COMPONENT_NAME_SIZE + 1u];
+		u32                    flags;
 
     };
 	
@@ -128,7 +264,12 @@ namespace sv {
 		u32              entity_size = 0u;
 		u32              entity_capacity = 0u;
 
+		// Depth first order of the entities, it is rebuilt from the links when is needed
 		List<Entity>     entity_hierarchy;
+		bool             hierarchy_dirty = false;
+		Entity           first_root = 0;
+		Entity           last_root = 0;
+		
 		List<Entity>     entity_free_list;
 
 		EntityPrefab prefabs[256];
@@ -139,6 +280,33 @@ namespace sv {
 		TagInternal tags[TAG_MAX];
 
 		ComponentAllocator component_allocator[COMPONENT_MAX];
+
+		List<Archetype> archetypes;
+		ThickHashTable<u32, 200> archetype_table;
+
+		List<QueryCache> queries;
+
+		// Structural changes recorded by each thread, executed at the end of the scene update
+		List<EntityCommandBuffer> command_buffers;
+		List<EntityCommandBuffer> playback_buffers;
+
+		// Hashed grid with the bounding spheres of the entities, the moved entities are updated after the world matrix pass
+		ThickHashTable<SpatialCell, 1024> spatial_cells;
+		List<SpatialEntry>                spatial_large; // Bigger than half cell
+		List<Entity>                      spatial_dirty;
+		bool                              spatial_3D = false;
+		// Contains all the cells, only grows while the grid isn't empty. Limits the traversal of the rays
+		v3_f32                            spatial_min;
+		v3_f32                            spatial_max;
+
+		// Incremented when a prefab child transform or the hierarchy changes, invalidates the mirror caches
+		u32              mirror_version = 0u;
+
+		// World matrix pass, the dirty entities are sorted by hierarchy level
+		List<u32>        transform_depth;
+		List<u32>        transform_level_offset;
+		List<Entity>     transform_entities;
+		List<Entity>     transform_sorted;
 		
 	};
 
@@ -152,6 +320,17 @@ namespace sv {
 	
     };
 
+	struct SceneSnapshot {
+
+		char name[SCENE_NAME_SIZE + 1u];
+		SceneData data;
+
+		// The component memory is a bitwise copy, the components without snapshot function are rebuilt from the serialized data
+		ECS ecs;
+		Serializer components;
+
+	};
+
     struct SceneState {
 
 		static constexpr u32 VERSION = 4u;
@@ -159,10 +338,28 @@ namespace sv {
 		char next_scene_name[SCENE_NAME_SIZE + 1u] = {};
 		Scene* scene = nullptr;
 
+		// Assets of the next scene, kept alive until the scene is started
+		char preload_scene_name[SCENE_NAME_SIZE + 1u] = {};
+		List<AssetPtr> preload_assets;
+
 		ComponentRegister component_register[COMPONENT_MAX];
 		u32 component_register_count = 0u;
 
 		TagRegister tag_register[TAG_MAX];
+
+		// Resolved at initialization, dispatched in every update or for every entity
+		struct {
+			EventHandle update_scene;
+			EventHandle update_physics;
+			EventHandle late_update_scene;
+			EventHandle on_entity_create;
+			EventHandle on_entity_destroy;
+			EventHandle on_entities_create;
+			EventHandle on_entities_destroy;
+			EventHandle on_entity_parent;
+		} events;
+
+		bool entity_events_suspended = false;
 		
     };
 
@@ -204,6 +401,12 @@ namespace sv {
 	SV_INTERNAL bool deserialize_ecs(Deserializer& d);
 	SV_INTERNAL void clear_ecs();
 	SV_INTERNAL void close_ecs();
+	SV_INTERNAL void update_spatial_index();
+	SV_AUX void dispatch_entities_create(const Entity* entities, u32 count);
+	SV_AUX void dispatch_entities_destroy(const Entity* entities, u32 count);
+	SV_AUX void reserve_entities(u32 min_capacity);
+	SV_AUX void free_old_removals();
+	SV_AUX void notify_transform(EntityTransform& t, Entity entity);
 
 #if SV_EDITOR
 	void reload_component(ReloadPluginEvent* e);
@@ -213,6 +416,18 @@ namespace sv {
     {
 		scene_state = SV_ALLOCATE_STRUCT(SceneState, "Scene");
 
+		{
+			auto& events = scene_state->events;
+			events.update_scene = event_handle("update_scene");
+			events.update_physics = event_handle("update_physics");
+			events.late_update_scene = event_handle("late_update_scene");
+			events.on_entity_create = event_handle("on_entity_create");
+			events.on_entity_destroy = event_handle("on_entity_destroy");
+			events.on_entities_create = event_handle("on_entities_create");
+			events.on_entities_destroy = event_handle("on_entities_destroy");
+			events.on_entity_parent = event_handle("on_entity_parent");
+		}
+
 		// Register assets
 		{
 			const char* extensions[] = {
@@ -268,7 +483,16 @@ namespace sv {
 		SV_FREE_STRUCT(scene_state);
     }
 
-    bool _start_scene(const char* name_)
+    bool _start_scene(const char* name)
+    {
+		char filepath[FILEPATH_SIZE + 1u] = "assets/scenes/";
+		string_append(filepath, string_validate(name), FILEPATH_SIZE + 1u);
+		string_append(filepath, ".scene", FILEPATH_SIZE + 1u);
+
+		return _start_scene(name, filepath);
+    }
+
+    bool _start_scene(const char* name_, const char* filepath)
     {
 		Scene*& scene_ptr = scene_state->scene;
 
@@ -300,11 +524,6 @@ namespace sv {
 
 		// Deserialize
 		{
-			// Get filepath
-			char filepath[FILEPATH_SIZE] = "assets/scenes/";
-			string_append(filepath, name, FILEPATH_SIZE + 1u);
-			string_append(filepath, ".scene", FILEPATH_SIZE + 1u);
-
 			bool res = deserialize_begin(d, filepath);
 
 			if (!res) {
@@ -364,9 +583,17 @@ namespace sv {
     {	
 		if (scene_state->next_scene_name[0] != '\0') {
 
+			// Keep the current scene until the assets are loaded
+			if (!scene_preload_finished())
+				return;
+
 			// TODO Handle error
 			_start_scene(scene_state->next_scene_name);
 			strcpy(scene_state->next_scene_name, "");
+
+			// The scene has its own references
+			scene_state->preload_assets.reset();
+			scene_state->preload_scene_name[0] = '\0';
 		}
     }
 
@@ -396,6 +623,43 @@ namespace sv {
 		}
 	
 		strcpy(scene_state->next_scene_name, name);
+		scene_preload(name);
+		return true;
+    }
+
+    bool scene_preload(const char* name)
+    {
+		name = string_validate(name);
+
+		if (string_size(name) > SCENE_NAME_SIZE) {
+			SV_LOG_ERROR("The scene name '%s' is to long, max chars = %u", name, SCENE_NAME_SIZE);
+			return false;
+		}
+
+		if (string_equals(scene_state->preload_scene_name, name))
+			return true;
+
+		scene_state->preload_assets.reset();
+		string_copy(scene_state->preload_scene_name, name, SCENE_NAME_SIZE + 1u);
+
+		char filepath[FILEPATH_SIZE + 1u] = "assets/scenes/";
+		string_append(filepath, name, FILEPATH_SIZE + 1u);
+		string_append(filepath, ".scene.preload", FILEPATH_SIZE + 1u);
+
+		if (!load_asset_manifest(filepath, scene_state->preload_assets)) {
+			SV_LOG_WARNING("The scene '%s' doesn't have preload manifest", name);
+			return false;
+		}
+
+		return true;
+    }
+
+    bool scene_preload_finished()
+    {
+		for (const AssetPtr& asset : scene_state->preload_assets) {
+			if (asset_is_loading(asset))
+				return false;
+		}
 		return true;
     }
 
@@ -417,6 +681,7 @@ namespace sv {
 		Serializer s;
 
 		serialize_begin(s);
+		asset_manifest_begin();
 
 		serialize_u32(s, SceneState::VERSION);
 
@@ -432,6 +697,12 @@ namespace sv {
 		serialize_ecs(s);
 
 		event_dispatch("save_scene", nullptr);
+
+		char manifest_filepath[FILEPATH_SIZE + 1u];
+		string_copy(manifest_filepath, filepath, FILEPATH_SIZE + 1u);
+		string_append(manifest_filepath, ".preload", FILEPATH_SIZE + 1u);
+
+		asset_manifest_end(manifest_filepath);
 		
 		return serialize_end(s, filepath);
     }
@@ -473,7 +744,7 @@ namespace sv {
 
 					MeshAsset mesh;
 
-					bool res = load_asset_from_file(mesh, filepath);
+					bool res = load_asset_from_file(mesh, filepath, AssetLoadingPriority_RightNow);
 
 					if (res) {
 					
@@ -571,19 +842,27 @@ namespace sv {
 			scene.data.main_camera = 0;
 		}
 
+		free_old_removals();
+
 #if SV_EDITOR
 		if (engine.update_scene) {
 #endif
-			event_dispatch("update_scene", NULL);
+			event_dispatch(scene_state->events.update_scene, NULL);
 
 			_physics3D_update();
-			event_dispatch("update_physics", NULL);
+			event_dispatch(scene_state->events.update_physics, NULL);
 		
-			event_dispatch("late_update_scene", NULL);
+			event_dispatch(scene_state->events.late_update_scene, NULL);
 #if SV_EDITOR
 		}
 #endif
 
+		// Sync point of the deferred structural changes
+		play_entity_commands();
+
+		update_world_matrices();
+		update_spatial_index();
+
 #if !(SV_EDITOR)
 		
 		CameraComponent* camera = get_main_camera();
@@ -691,6 +970,132 @@ namespace sv {
 
 	/////////////////////////////////////// ECS //////////////////////////////////////////////////////////
 
+	SV_AUX void tag_insert(TagInternal& tag, Entity entity)
+	{
+		if (tag.sparse.size() < entity)
+			tag.sparse.resize(entity, u32_max);
+
+		tag.sparse[entity - 1u] = u32(tag.entities.size());
+		tag.entities.push_back(entity);
+	}
+
+	SV_AUX void tag_erase(TagInternal& tag, Entity entity)
+	{
+		SV_ASSERT(entity <= tag.sparse.size() && tag.sparse[entity - 1u] != u32_max);
+
+		u32 index = tag.sparse[entity - 1u];
+		Entity last = tag.entities.back();
+
+		tag.entities[index] = last;
+		tag.sparse[last - 1u] = index;
+
+		tag.entities.pop_back();
+		tag.sparse[entity - 1u] = u32_max;
+	}
+
+	SV_AUX void link_entity(Entity entity, Entity parent)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		internal.parent = parent;
+		internal.next_sibling = 0;
+
+		Entity& first = parent ? ecs.entity_internal[parent - 1u].first_child : ecs.first_root;
+		Entity& last = parent ? ecs.entity_internal[parent - 1u].last_child : ecs.last_root;
+
+		internal.prev_sibling = last;
+
+		if (last) ecs.entity_internal[last - 1u].next_sibling = entity;
+		else first = entity;
+
+		last = entity;
+		ecs.hierarchy_dirty = true;
+	}
+
+	SV_AUX void unlink_entity(Entity entity)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		Entity parent = internal.parent;
+
+		Entity& first = parent ? ecs.entity_internal[parent - 1u].first_child : ecs.first_root;
+		Entity& last = parent ? ecs.entity_internal[parent - 1u].last_child : ecs.last_root;
+
+		if (internal.prev_sibling) ecs.entity_internal[internal.prev_sibling - 1u].next_sibling = internal.next_sibling;
+		else first = internal.next_sibling;
+
+		if (internal.next_sibling) ecs.entity_internal[internal.next_sibling - 1u].prev_sibling = internal.prev_sibling;
+		else last = internal.prev_sibling;
+
+		internal.parent = 0;
+		internal.next_sibling = 0;
+		internal.prev_sibling = 0;
+		ecs.hierarchy_dirty = true;
+	}
+
+	// Next entity of the subtree in depth first order, returns 0 at the end of the subtree
+	SV_AUX Entity next_subtree_entity(Entity root, Entity entity)
+	{
+		SV_ECS();
+
+		const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		if (internal.first_child) return internal.first_child;
+
+		while (entity != root) {
+
+			const EntityInternal& it = ecs.entity_internal[entity - 1u];
+			if (it.next_sibling) return it.next_sibling;
+			entity = it.parent;
+		}
+
+		return 0;
+	}
+
+	// Rebuilds entity_hierarchy, the hierarchy indices and the child counts
+	SV_AUX void update_hierarchy()
+	{
+		SV_ECS();
+
+		if (!ecs.hierarchy_dirty) return;
+		ecs.hierarchy_dirty = false;
+
+		// The mirror indices can change
+		++ecs.mirror_version;
+
+		ecs.entity_hierarchy.reset();
+
+		u32 size = 0u;
+		Entity entity = ecs.first_root;
+
+		while (entity) {
+
+			EntityInternal& internal = ecs.entity_internal[entity - 1u];
+			internal.hierarchy_index = size++;
+			ecs.entity_hierarchy.push_back(entity);
+
+			if (internal.first_child) {
+				entity = internal.first_child;
+				continue;
+			}
+
+			// Close the subtrees that end here
+			while (entity) {
+
+				EntityInternal& it = ecs.entity_internal[entity - 1u];
+				it.child_count = size - it.hierarchy_index - 1u;
+
+				if (it.next_sibling) {
+					entity = it.next_sibling;
+					break;
+				}
+
+				entity = it.parent;
+			}
+		}
+	}
+
 	SV_AUX Entity get_origin_entity(Entity entity)
 	{
 		return entity & 0x00FFFFFF;
@@ -712,6 +1117,8 @@ namespace sv {
 
 			if (is_prefab(internal.prefab)) {
 
+				update_hierarchy();
+				
 				EntityInternal& prefab = ecs.entity_internal[internal.prefab - 1];
 
 				if (index < prefab.child_count) {
@@ -725,6 +1132,89 @@ namespace sv {
 		return 0;
 	}
 
+	SV_AUX EntityMirrorBlock& get_mirror_block(Entity instance)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[instance - 1u];
+
+		if (internal.mirrors == NULL) {
+
+			internal.mirrors = SV_ALLOCATE_STRUCT(EntityMirrorBlock, "Scene");
+			internal.mirrors->version = ecs.mirror_version;
+			internal.mirrors->dirty = true;
+		}
+
+		return *internal.mirrors;
+	}
+
+	SV_AUX void free_mirror_block(EntityInternal& internal)
+	{
+		if (internal.mirrors) {
+			SV_FREE_STRUCT(internal.mirrors);
+			internal.mirrors = NULL;
+		}
+	}
+
+	SV_AUX void mark_spatial_dirty(Entity entity)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+		if (!internal.spatial_dirty) {
+			internal.spatial_dirty = true;
+			ecs.spatial_dirty.push_back(entity);
+		}
+	}
+
+	SV_AUX void spatial_compute_cell_bounds(SpatialCell& cell)
+	{
+		foreach(i, 3u) {
+			cell.min[i] = f32_max;
+			cell.max[i] = -f32_max;
+		}
+
+		for (const SpatialEntry& entry : cell.entries) {
+
+			foreach(i, 3u) {
+				cell.min[i] = SV_MIN(cell.min[i], entry.center[i] - entry.radius);
+				cell.max[i] = SV_MAX(cell.max[i], entry.center[i] + entry.radius);
+			}
+		}
+	}
+
+	SV_AUX void spatial_remove(Entity entity)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		u64 key = internal.spatial_cell;
+
+		if (key == 0u) return;
+
+		SpatialCell* cell = (key == SPATIAL_CELL_LARGE) ? NULL : ecs.spatial_cells.find(key);
+		List<SpatialEntry>& entries = cell ? cell->entries : ecs.spatial_large;
+
+		u32 index = internal.spatial_index;
+		SV_ASSERT(index < entries.size() && entries[index].entity == entity);
+
+		if (index + 1u != entries.size()) {
+			entries[index] = entries.back();
+			ecs.entity_internal[entries[index].entity - 1u].spatial_index = index;
+		}
+		entries.pop_back();
+
+		if (cell) {
+
+			if (entries.empty()) ecs.spatial_cells.erase(key);
+			else spatial_compute_cell_bounds(*cell);
+		}
+
+		internal.spatial_cell = 0u;
+		internal.spatial_index = 0u;
+	}
+
 	SV_AUX void create_component(CompID comp_id, Component* ptr, Entity entity)
     {
 		scene_state->component_register[comp_id].create_fn(ptr, entity);
@@ -757,9 +1247,22 @@ namespace sv {
 		if (fn) fn(comp, deserializer, version);
     }
 
-	SV_AUX bool has_free_components(ComponentPool& pool)
+	SV_AUX u32 get_pool_begin(u32 pool_index)
+	{
+		return COMPONENT_POOL_BASE_CAPACITY * ((1u << pool_index) - 1u);
+	}
+
+	SV_AUX Component* get_pool_component(ComponentAllocator& alloc, u32 size, u32 slot, ComponentPool** ppool)
 	{
-		return pool.count < pool.capacity || pool.free_count;
+		u32 pool_index = 0u;
+		while (slot >= get_pool_begin(pool_index + 1u))
+			++pool_index;
+
+		SV_ASSERT(pool_index < alloc.pool_count);
+
+		ComponentPool* pool = alloc.pools + pool_index;
+		*ppool = pool;
+		return reinterpret_cast<Component*>(pool->data + (slot - get_pool_begin(pool_index)) * size);
 	}
 
 	SV_AUX Component* allocate_component(CompID comp_id)
@@ -769,71 +1272,46 @@ namespace sv {
 		ComponentRegister& reg = scene_state->component_register[comp_id];
 		ComponentAllocator& alloc = ecs.component_allocator[comp_id];
 
-		ComponentPool* pool = NULL;
+		Component* component = NULL;
+
+		// Reuse a vacant slot
+		if (alloc.free_list) {
 
-		foreach(i, alloc.pool_count) {
+			ComponentPool* pool;
+			component = get_pool_component(alloc, reg.size, alloc.free_list - 1u, &pool);
 
-			if (has_free_components(alloc.pools[i])) {
+			SV_ASSERT(component->id == 0u);
+			alloc.free_list = component->flags;
+			component->flags = 0u;
 
-				pool = alloc.pools + i;
-				break;
-			}
+			--pool->free_count;
+			return component;
 		}
 
-		if (pool == NULL) {
+		ComponentPool* pool = (alloc.pool_count) ? (alloc.pools + alloc.pool_count - 1u) : NULL;
 
-			ComponentPool* new_pools = (ComponentPool*) SV_ALLOCATE_MEMORY(sizeof(ComponentPool) * (alloc.pool_count + 1), "Scene");
+		if (pool == NULL || pool->count == pool->capacity) {
 
-			if (alloc.pools) {
-				memcpy(new_pools, alloc.pools, sizeof(ComponentPool) * alloc.pool_count);
-				SV_FREE_MEMORY(alloc.pools);
-			}
+			SV_ASSERT(alloc.pool_count < COMPONENT_POOL_MAX);
 
-			alloc.pools = new_pools;
-			pool = alloc.pools + alloc.pool_count++;
+			pool = alloc.pools + alloc.pool_count;
 
 			pool->count = 0u;
-			pool->capacity = 3u;
+			pool->capacity = COMPONENT_POOL_BASE_CAPACITY << alloc.pool_count;
 			pool->free_count = 0u;
-			pool->data = (u8*)SV_ALLOCATE_MEMORY(reg.size * pool->capacity, "Scene");
-		}
-
-		Component* component = NULL;
-
-		if (pool->free_count) {
-
-			u8* it = pool->data;
-			u8* end = pool->data + pool->count * reg.size;
-
-			while (it < end) {
+			pool->data = (u8*)SV_ALLOCATE_MEMORY(size_t(reg.size) * size_t(pool->capacity), "Scene");
 
-				Component* comp = reinterpret_cast<Component*>(it);
-
-				if (comp->id == 0u) {
-
-					component = comp;
-					break;
-				}
-				
-				it += reg.size;
-			}
-
-			SV_ASSERT(component);
-			--pool->free_count;
-		}
-		else {
-
-			SV_ASSERT(pool->count < pool->capacity);
-
-			component = reinterpret_cast<Component*>(pool->data + (pool->count * reg.size));
-			++pool->count;
+			++alloc.pool_count;
 		}
 
-		SV_ASSERT(component);
+		component = reinterpret_cast<Component*>(pool->data + (pool->count * reg.size));
+		++pool->count;
 
 		return component;
 	}
 
+	SV_AUX void compact_component(CompID comp_id, Component* hole);
+
 	SV_AUX void free_component(CompRef comp_ref)
 	{
 		SV_ECS();
@@ -844,28 +1322,354 @@ namespace sv {
 		ComponentRegister& reg = scene_state->component_register[comp_id];
 		ComponentAllocator& alloc = ecs.component_allocator[comp_id];
 
+		ComponentRemoval& removal = alloc.removals.emplace_back();
+		removal.entity = comp->id & ~SV_BIT(31);
+		removal.frame = engine.frame_count;
+
 		destroy_component(comp_id, comp);
 
-		ComponentPool* pool = NULL;
+		// The memory is released when the entity leaves the archetype
+		if (reg.flags & ComponentRegisterFlag_Archetype)
+			return;
 
-		foreach(i, alloc.pool_count) {
+		if (reg.flags & ComponentRegisterFlag_Compact) {
+			compact_component(comp_id, comp);
+			return;
+		}
 
-			ComponentPool* p = alloc.pools + i;
+		foreach(i, alloc.pool_count) {
 
-			if (p->data <= (u8*)comp && p->data + p->count * reg.size > (u8*)comp) {
-				pool = p;
-				break;
+			ComponentPool* pool = alloc.pools + i;
+
+			if (pool->data <= (u8*)comp && pool->data + pool->count * reg.size > (u8*)comp) {
+
+				u32 slot = get_pool_begin(i) + u32(((u8*)comp - pool->data) / reg.size);
+
+				comp->flags = alloc.free_list;
+				alloc.free_list = slot + 1u;
+				++pool->free_count;
+				return;
+			}
+		}
+
+		SV_ASSERT(0);
+	}
+
+	SV_AUX bool is_archetype_component(CompID comp_id)
+	{
+		return scene_state->component_register[comp_id].flags & ComponentRegisterFlag_Archetype;
+	}
+
+	SV_AUX u32 find_archetype_column(const Archetype& archetype, CompID comp_id)
+	{
+		foreach(i, archetype.column_count) {
+			if (archetype.columns[i].comp_id == comp_id)
+				return i;
+		}
+		return u32_max;
+	}
+
+	SV_AUX Entity* get_archetype_entities(Archetype& archetype, u32 row)
+	{
+		u8* chunk = archetype.chunks[row / archetype.chunk_capacity];
+		return reinterpret_cast<Entity*>(chunk) + (row % archetype.chunk_capacity);
+	}
+
+	SV_AUX u8* get_archetype_data(Archetype& archetype, u32 column, u32 row)
+	{
+		const ArchetypeColumn& c = archetype.columns[column];
+		u8* chunk = archetype.chunks[row / archetype.chunk_capacity];
+		return chunk + c.offset + (row % archetype.chunk_capacity) * c.stride;
+	}
+
+	SV_AUX Component* get_archetype_component(Archetype& archetype, u32 column, u32 row)
+	{
+		u8* data = get_archetype_data(archetype, column, row);
+		return archetype.columns[column].is_inline ? reinterpret_cast<Component*>(data) : *reinterpret_cast<Component**>(data);
+	}
+
+	SV_AUX void mark_chunk_changed(Archetype& archetype, u32 row, u32 column)
+	{
+		archetype.versions[(row / archetype.chunk_capacity) * archetype.column_count + column] = engine.frame_count;
+	}
+
+	SV_AUX void mark_row_changed(Archetype& archetype, u32 row)
+	{
+		u64* versions = archetype.versions.data() + (row / archetype.chunk_capacity) * archetype.column_count;
+		
+		foreach(i, archetype.column_count)
+			versions[i] = engine.frame_count;
+	}
+
+	// Marks all the components of the entity as changed
+	SV_AUX void mark_entity_changed(Entity entity)
+	{
+		SV_ECS();
+
+		const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+		if (internal.archetype != u32_max)
+			mark_row_changed(ecs.archetypes[internal.archetype], internal.archetype_row);
+	}
+
+	SV_AUX u32 get_archetype(u64 mask)
+	{
+		SV_ECS();
+
+		u32* index = ecs.archetype_table.find(mask);
+		if (index) return *index;
+
+		u32 archetype_index = u32(ecs.archetypes.size());
+		Archetype& archetype = ecs.archetypes.emplace_back();
+		archetype.mask = mask;
+		archetype.column_count = 0u;
+		archetype.count = 0u;
+
+		u32 row_size = sizeof(Entity);
+
+		foreach(comp_id, COMPONENT_MAX) {
+
+			if (mask & SV_BIT(comp_id)) {
+
+				SV_ASSERT(archetype.column_count < ENTITY_COMPONENTS_MAX);
+
+				ArchetypeColumn& column = archetype.columns[archetype.column_count++];
+				column.comp_id = comp_id;
+				column.is_inline = is_archetype_component(comp_id);
+				column.stride = column.is_inline ? get_component_size(comp_id) : u32(sizeof(Component*));
+
+				row_size += column.stride;
+
+				ecs.component_allocator[comp_id].archetypes.push_back(archetype_index);
+			}
+		}
+
+		// Each array is aligned to 16 bytes
+		u32 padding = 16u * (archetype.column_count + 1u);
+		archetype.chunk_capacity = (ARCHETYPE_CHUNK_SIZE > padding + row_size) ? ((ARCHETYPE_CHUNK_SIZE - padding) / row_size) : 1u;
+
+		u32 offset = (sizeof(Entity) * archetype.chunk_capacity + 15u) & ~15u;
+
+		foreach(i, archetype.column_count) {
+
+			ArchetypeColumn& column = archetype.columns[i];
+			column.offset = offset;
+			offset = (offset + column.stride * archetype.chunk_capacity + 15u) & ~15u;
+		}
+
+		archetype.chunk_size = offset;
+
+		ecs.archetype_table[mask] = archetype_index;
+		return archetype_index;
+	}
+
+	SV_AUX void update_archetype_refs(EntityInternal& internal, Archetype& archetype)
+	{
+		foreach(i, internal.component_count) {
+
+			CompRef& ref = internal.components[i];
+
+			if (is_archetype_component(ref.comp_id)) {
+
+				u32 column = find_archetype_column(archetype, ref.comp_id);
+				if (column != u32_max)
+					ref.comp = reinterpret_cast<Component*>(get_archetype_data(archetype, column, internal.archetype_row));
+			}
+		}
+	}
+
+	// Moves the last component of the pools to the hole, the pools of compact components are full except the last one
+	SV_AUX void compact_component(CompID comp_id, Component* hole)
+	{
+		SV_ECS();
+
+		ComponentRegister& reg = scene_state->component_register[comp_id];
+		ComponentAllocator& alloc = ecs.component_allocator[comp_id];
+
+		SV_ASSERT(alloc.pool_count);
+
+		ComponentPool* pool = alloc.pools + alloc.pool_count - 1u;
+		SV_ASSERT(pool->count);
+
+		Component* last = reinterpret_cast<Component*>(pool->data + (pool->count - 1u) * reg.size);
+
+		if (last != hole) {
+
+			memcpy(hole, last, reg.size);
+
+			// Patch the references of the owner
+			Entity owner = hole->id & ~SV_BIT(31);
+			EntityInternal& internal = ecs.entity_internal[owner - 1u];
+
+			foreach(i, internal.component_count) {
+
+				CompRef& ref = internal.components[i];
+
+				if (ref.comp_id == comp_id) {
+					ref.comp = hole;
+					break;
+				}
+			}
+
+			if (internal.archetype != u32_max) {
+
+				Archetype& archetype = ecs.archetypes[internal.archetype];
+				u32 column = find_archetype_column(archetype, comp_id);
+				SV_ASSERT(column != u32_max);
+
+				*reinterpret_cast<Component**>(get_archetype_data(archetype, column, internal.archetype_row)) = hole;
+			}
+
+			last->id = 0u;
+			last->flags = 0u;
+		}
+
+		if (--pool->count == 0u) {
+
+			SV_FREE_MEMORY(pool->data);
+			pool->data = NULL;
+			--alloc.pool_count;
+		}
+	}
+
+	SV_AUX void archetype_remove_row(Archetype& archetype, u32 row)
+	{
+		SV_ECS();
+		SV_ASSERT(row < archetype.count);
+
+		u32 last = archetype.count - 1u;
+
+		// Fill the hole with the last row
+		if (row != last) {
+
+			Entity moved = *get_archetype_entities(archetype, last);
+			*get_archetype_entities(archetype, row) = moved;
+
+			foreach(i, archetype.column_count) {
+				memcpy(get_archetype_data(archetype, i, row), get_archetype_data(archetype, i, last), archetype.columns[i].stride);
+			}
+
+			EntityInternal& internal = ecs.entity_internal[moved - 1u];
+			internal.archetype_row = row;
+			update_archetype_refs(internal, archetype);
+
+			mark_row_changed(archetype, row);
+		}
+
+		--archetype.count;
+
+		// Keep one empty chunk to avoid allocating every time an entity moves
+		u32 chunk_count = (archetype.count + archetype.chunk_capacity - 1u) / archetype.chunk_capacity;
+
+		while (archetype.chunks.size() > chunk_count + 1u) {
+
+			SV_FREE_MEMORY(archetype.chunks.back());
+			archetype.chunks.pop_back();
+			archetype.versions.pop_back(archetype.column_count);
+		}
+	}
+
+	// Moves the entity to the archetype of the mask. The new inline components are uninitialized and the removed ones must be destroyed before
+	SV_AUX void archetype_move(Entity entity, EntityInternal& internal, u64 mask)
+	{
+		SV_ECS();
+
+		u32 old_index = internal.archetype;
+		u32 old_row = internal.archetype_row;
+
+		u32 index = (mask != 0u) ? get_archetype(mask) : u32_max;
+
+		if (index == old_index)
+			return;
+
+		Archetype* old = (old_index != u32_max) ? &ecs.archetypes[old_index] : NULL;
+
+		if (index != u32_max) {
+
+			Archetype& archetype = ecs.archetypes[index];
+
+			if (archetype.count == archetype.chunks.size() * archetype.chunk_capacity) {
+				archetype.chunks.push_back((u8*)SV_ALLOCATE_MEMORY(archetype.chunk_size, "Scene"));
+				archetype.versions.resize(archetype.chunks.size() * archetype.column_count, engine.frame_count);
+			}
+
+			u32 row = archetype.count++;
+			mark_row_changed(archetype, row);
+			*get_archetype_entities(archetype, row) = entity;
+
+			foreach(i, archetype.column_count) {
+
+				const ArchetypeColumn& column = archetype.columns[i];
+				u8* dst = get_archetype_data(archetype, i, row);
+
+				if (column.is_inline) {
+
+					u32 old_column = old ? find_archetype_column(*old, column.comp_id) : u32_max;
+
+					if (old_column != u32_max)
+						memcpy(dst, get_archetype_data(*old, old_column, old_row), column.stride);
+					else
+						memset(dst, 0, column.stride);
+				}
+				else {
+
+					Component* comp = NULL;
+
+					foreach(j, internal.component_count) {
+						if (internal.components[j].comp_id == column.comp_id) {
+							comp = internal.components[j].comp;
+							break;
+						}
+					}
+
+					SV_ASSERT(comp);
+					*reinterpret_cast<Component**>(dst) = comp;
+				}
 			}
+
+			internal.archetype = index;
+			internal.archetype_row = row;
+			update_archetype_refs(internal, archetype);
+		}
+		else {
+			internal.archetype = u32_max;
+			internal.archetype_row = 0u;
 		}
 
-		SV_ASSERT(pool);
+		if (old) archetype_remove_row(*old, old_row);
+	}
+
+	// Returns the uninitialized memory of the new entity component
+	SV_AUX Component* attach_component(Entity entity, EntityInternal& internal, CompID comp_id)
+	{
+		SV_ASSERT(internal.component_count < ENTITY_COMPONENTS_MAX);
+		SV_ASSERT(!(internal.component_mask & SV_BIT(comp_id)));
+
+		CompRef& ref = internal.components[internal.component_count++];
+		ref.comp_id = comp_id;
+		ref.comp = is_archetype_component(comp_id) ? NULL : allocate_component(comp_id);
+
+		internal.component_mask |= SV_BIT(comp_id);
+		archetype_move(entity, internal, internal.component_mask);
+
+		SV_ASSERT(ref.comp);
+		return ref.comp;
+	}
+
+	SV_AUX void detach_component(Entity entity, EntityInternal& internal, u32 index)
+	{
+		SV_ASSERT(index < internal.component_count);
 
-		if (pool) {
+		CompRef ref = internal.components[index];
+		free_component(ref);
 
-			++pool->free_count;
+		for (u32 i = index + 1u; i < internal.component_count; ++i) {
+			internal.components[i - 1u] = internal.components[i];
 		}
+		--internal.component_count;
 
-		// TODO: Destroy pool
+		internal.component_mask &= ~SV_BIT(ref.comp_id);
+		archetype_move(entity, internal, internal.component_mask);
 	}
 
 	SV_AUX EntityPrefab* find_prefab(u64 hash)
@@ -934,6 +1738,24 @@ namespace sv {
 	
 	constexpr u32 ENTITY_ALLOCATION_POOL = 100u;
 
+	SV_AUX void reset_command_buffer(EntityCommandBuffer& buffer)
+	{
+		// Destroy the component copies that aren't executed
+		for (EntityCommand& cmd : buffer.commands) {
+
+			if (cmd.type == EntityCommandType_SetComponent && cmd.data != u32_max) {
+				
+				Component* comp = reinterpret_cast<Component*>(buffer.data.data() + cmd.data);
+				scene_state->component_register[cmd.comp_id].destroy_fn(comp, 0);
+			}
+		}
+		
+		buffer.commands.reset();
+		buffer.data.reset();
+		buffer.created.reset();
+		buffer.create_count = 0u;
+	}
+
 	void initialize_ecs()
 	{
 		SV_ECS();
@@ -941,9 +1763,13 @@ namespace sv {
 		for (CompID id = 0u; id < COMPONENT_MAX; ++id) {
 			
 			ComponentAllocator& alloc = ecs.component_allocator[id];
-			alloc.pools = NULL;
 			alloc.pool_count = 0u;
+			alloc.free_list = 0u;
+			alloc.archetypes.clear();
+			alloc.removals.clear();
 		}
+
+		ecs.command_buffers.resize(task_thread_count());
 	}
 
 	void clear_ecs()
@@ -956,13 +1782,9 @@ namespace sv {
 	{
 		SV_ECS();
 		
-		// TODO: Dispatch events at once
-		for (Entity entity : ecs.entity_hierarchy) {
-			
-			EntityDestroyEvent e;
-			e.entity = entity;
-			event_dispatch("on_entity_destroy", &e);
-		}
+		update_hierarchy();
+		
+		dispatch_entities_destroy(ecs.entity_hierarchy.data(), u32(ecs.entity_hierarchy.size()));
 		
 		for (CompID id = 0; id < scene_state->component_register_count; ++id) {
 
@@ -992,14 +1814,52 @@ namespace sv {
 					SV_FREE_MEMORY(pool->data);
 				}
 			}
+		}
 
-			if (alloc.pools) {
-				SV_FREE_MEMORY(alloc.pools);
+		for (Archetype& archetype : ecs.archetypes) {
+
+			foreach(i, archetype.column_count) {
+
+				const ArchetypeColumn& column = archetype.columns[i];
+				if (!column.is_inline) continue;
+
+				foreach(row, archetype.count) {
+
+					Component* comp = get_archetype_component(archetype, i, row);
+
+					if (comp->id != 0) {
+						destroy_component(column.comp_id, comp);
+					}
+				}
 			}
+
+			for (u8* chunk : archetype.chunks)
+				SV_FREE_MEMORY(chunk);
 		}
+
+		for (EntityCommandBuffer& buffer : ecs.command_buffers)
+			reset_command_buffer(buffer);
+
+		ecs.command_buffers.clear();
+		ecs.playback_buffers.clear();
+
+		ecs.spatial_cells.clear();
+		ecs.spatial_large.clear();
+		ecs.spatial_dirty.clear();
+
+		ecs.archetypes.clear();
+		ecs.archetype_table.clear();
+		ecs.queries.clear();
+		ecs.transform_depth.clear();
+		ecs.transform_level_offset.clear();
+		ecs.transform_entities.clear();
+		ecs.transform_sorted.clear();
 		
 		if (ecs.entity_internal) {
 
+			foreach(i, ecs.entity_size)
+				free_mirror_block(ecs.entity_internal[i]);
+
 			SV_FREE_MEMORY(ecs.entity_internal);
 			SV_FREE_MEMORY(ecs.entity_misc);
 			SV_FREE_MEMORY(ecs.entity_transform);
@@ -1010,6 +1870,9 @@ namespace sv {
 			ecs.entity_size = 0u;
 			ecs.entity_capacity = 0u;
 			ecs.entity_hierarchy.clear();
+			ecs.hierarchy_dirty = false;
+			ecs.first_root = 0;
+			ecs.last_root = 0;
 			ecs.entity_free_list.clear();
 		}
 
@@ -1030,10 +1893,20 @@ namespace sv {
 		e.component_count = 0u;
 		e.tag_mask = 0u;
 		e.hierarchy_index = u32_max;
-		e.parent = 0u;
 		e.child_count = 0u;
+		e.parent = 0u;
+		e.first_child = 0u;
+		e.last_child = 0u;
+		e.next_sibling = 0u;
+		e.prev_sibling = 0u;
 		e.prefab = 0u;
 		e.own_prefab = NULL;
+		e.mirrors = NULL;
+		e.spatial_cell = 0u;
+		e.spatial_index = 0u;
+		e.spatial_dirty = false;
+		e.archetype = u32_max;
+		e.archetype_row = 0u;
 	}
 
 	SV_AUX void initialize_entity_misc(EntityMisc& e)
@@ -1068,19 +1941,17 @@ namespace sv {
 	{
 		SV_ECS();
 		
-		const EntityInternal& internal = ecs.entity_internal[entity - 1u];
 		u32 count = 0u;
+		Entity child = ecs.entity_internal[entity - 1u].first_child;
 
-		foreach(i, internal.child_count) {
+		while (child) {
 
-			Entity child = ecs.entity_hierarchy[internal.hierarchy_index + i + 1u];
 			if (is_serializable(child)) {
 
 				count += 1 + get_serializable_child_count(child);
-
-				const EntityInternal& child_internal = ecs.entity_internal[child - 1u];
-				i += child_internal.child_count;
 			}
+
+			child = ecs.entity_internal[child - 1u].next_sibling;
 		}
 
 		return count;
@@ -1090,8 +1961,10 @@ namespace sv {
 	{
 		SV_ECS();
 
-		constexpr u32 VERSION = 0u;
+		constexpr u32 VERSION = 1u;
 		serialize_u32(s, VERSION);
+
+		update_hierarchy();
 		
 		// Registers
 		{
@@ -1173,6 +2046,36 @@ namespace sv {
 							serialize_u32(s, comp_id);
 							serialize_component(comp_id, internal.components[i].comp, s);
 						}
+
+						// Mirror overrides, saved with the mirror index
+						{
+							u32 override_count = 0u;
+							u32 override_count_pos = u32(s.buff.size());
+							serialize_u32(s, override_count);
+
+							if (internal.mirrors) {
+
+								const EntityInternal& prefab = ecs.entity_internal[internal.prefab - 1u];
+
+								for (const EntityMirrorOverride& o : internal.mirrors->overrides) {
+
+									// The prefab child can be destroyed
+									if (!entity_exists(o.child)) continue;
+
+									u32 index = ecs.entity_internal[o.child - 1u].hierarchy_index;
+									if (index <= prefab.hierarchy_index || index > prefab.hierarchy_index + prefab.child_count) continue;
+									index -= prefab.hierarchy_index + 1u;
+
+									serialize_u32(s, index);
+									serialize_v3_f32(s, o.transform.position);
+									serialize_v4_f32(s, o.transform.rotation);
+									serialize_v3_f32(s, o.transform.scale);
+									++override_count;
+								}
+							}
+
+							memcpy(s.buff.data() + override_count_pos, &override_count, sizeof(u32));
+						}
 					}
 					else {
 
@@ -1199,7 +2102,8 @@ namespace sv {
 		CompID id;
 	};
 
-	static Entity deserialize_entity(Deserializer& d, Entity parent, const List<TempTagRegister>& tag_registers, const List<TempComponentRegister>& component_registers)
+	// The entity count includes the childs
+	static Entity deserialize_entity(Deserializer& d, u32 version, Entity parent, const List<TempTagRegister>& tag_registers, const List<TempComponentRegister>& component_registers, u32& entity_count)
 	{
 		SV_ECS();
 		
@@ -1261,34 +2165,63 @@ namespace sv {
 		// Components
 		{
 			EntityInternal& internal = ecs.entity_internal[entity - 1];
-			deserialize_u32(d, internal.component_count);
 
-			foreach(i, internal.component_count) {
+			u32 component_count;
+			deserialize_u32(d, component_count);
+
+			foreach(i, component_count) {
 
 				CompID file_comp_id;
 				deserialize_u32(d, file_comp_id);
 
 				const TempComponentRegister& reg = component_registers[file_comp_id];
 				CompID comp_id = reg.id;
-				u32 version = reg.version;
+				u32 comp_version = reg.version;
 				
-				Component* comp = allocate_component(comp_id);
+				Component* comp = attach_component(entity, internal, comp_id);
 				create_component(comp_id, comp, entity);
-				deserialize_component(comp_id, comp, d, version);
+				deserialize_component(comp_id, comp, d, comp_version);
+			}
+		}
 
-				CompRef& ref = internal.components[i];
-				ref.comp_id = comp_id;
-				ref.comp = comp;
-						
-				internal.component_mask |= (1ULL << (u64)comp_id);
+		// Mirror overrides
+		if (version >= 1u) {
+
+			u32 override_count;
+			deserialize_u32(d, override_count);
+
+			foreach(i, override_count) {
+
+				u32 index;
+				EntityMirrorOverride o;
+				deserialize_u32(d, index);
+				deserialize_v3_f32(d, o.transform.position);
+				deserialize_v4_f32(d, o.transform.rotation);
+				deserialize_v3_f32(d, o.transform.scale);
+
+				if (prefab_entity) {
+
+					update_hierarchy();
+					const EntityInternal& prefab = ecs.entity_internal[prefab_entity - 1u];
+
+					// The prefab can change after saving the scene
+					if (index < prefab.child_count) {
+						o.child = ecs.entity_hierarchy[prefab.hierarchy_index + 1u + index];
+						get_mirror_block(entity).overrides.push_back(o);
+					}
+				}
 			}
 		}
 		
-		foreach(i, child_count) {
+		entity_count = 1u;
+
+		for (u32 i = 0u; i < child_count;) {
 
-			Entity child = deserialize_entity(d, entity, tag_registers, component_registers);
+			u32 count;
+			deserialize_entity(d, version, entity, tag_registers, component_registers, count);
 
-			i += ecs.entity_internal[child - 1].child_count;
+			i += count;
+			entity_count += count;
 		}
 
 		return entity;
@@ -1350,8 +2283,10 @@ namespace sv {
 
 			if (type == 0) break;
 
-			if (type == 1)
-				deserialize_entity(d, 0, tag_registers, component_registers);
+			if (type == 1) {
+				u32 entity_count;
+				deserialize_entity(d, version, 0, tag_registers, component_registers, entity_count);
+			}
 			else {
 
 				char filepath[FILEPATH_SIZE + 1];
@@ -1363,203 +2298,592 @@ namespace sv {
 		return true;
 	}
 
-	SV_AUX void allocate_entities()
-	{
-		SV_ECS();
+	///////////////////////////////////// SNAPSHOTS ///////////////////////////////////////
 
-		u32 new_entity_capacity = ecs.entity_capacity + ENTITY_ALLOCATION_POOL;
+	// Translates a pointer to a pool slot of src to the same slot of dst, both allocators have the same pool layout
+	SV_AUX Component* rebase_pool_component(const ComponentAllocator& src, const ComponentAllocator& dst, u32 size, const Component* comp)
+	{
+		const u8* ptr = reinterpret_cast<const u8*>(comp);
 		
-		EntityInternal* new_internal = (EntityInternal*) SV_ALLOCATE_MEMORY(sizeof(EntityInternal) * new_entity_capacity, "Scene");
-		EntityMisc* new_misc = (EntityMisc*) SV_ALLOCATE_MEMORY(sizeof(EntityMisc) * new_entity_capacity, "Scene");
-		EntityTransform* new_transform = (EntityTransform*) SV_ALLOCATE_MEMORY(sizeof(EntityTransform) * new_entity_capacity, "Scene");
-
-		if (ecs.entity_capacity) {
+		foreach(i, src.pool_count) {
 
-			memcpy(new_internal, ecs.entity_internal, sizeof(EntityInternal) * ecs.entity_capacity);
-			memcpy(new_misc, ecs.entity_misc, sizeof(EntityMisc) * ecs.entity_capacity);
-			memcpy(new_transform, ecs.entity_transform, sizeof(EntityTransform) * ecs.entity_capacity);
+			const ComponentPool& pool = src.pools[i];
 
-			SV_FREE_MEMORY(ecs.entity_internal);
-			SV_FREE_MEMORY(ecs.entity_misc);
-			SV_FREE_MEMORY(ecs.entity_transform);
+			if (ptr >= pool.data && ptr < pool.data + size_t(pool.capacity) * size_t(size))
+				return reinterpret_cast<Component*>(dst.pools[i].data + (ptr - pool.data));
 		}
 
-		foreach(i, ENTITY_ALLOCATION_POOL) {
+		SV_ASSERT(0);
+		return NULL;
+	}
 
-			EntityInternal& e = new_internal[i + ecs.entity_capacity];
-			initialize_entity_internal(e);
-		}
-		foreach(i, ENTITY_ALLOCATION_POOL) {
+	// Copies the memory of an ECS into an empty one. The components are copied bitwise, the caller is responsible of rebuilding them
+	SV_INTERNAL void copy_ecs(ECS& dst, const ECS& src)
+	{
+		// Entities
+		{
+			u32 capacity = src.entity_capacity;
 
-			EntityMisc& e = new_misc[i + ecs.entity_capacity];
-			initialize_entity_misc(e);
-		}
-		foreach(i, ENTITY_ALLOCATION_POOL) {
+			dst.entity_size = src.entity_size;
+			dst.entity_capacity = capacity;
 
-			EntityTransform& e = new_transform[i + ecs.entity_capacity];
-			initialize_entity_transform(e);
+			if (capacity) {
+				
+				dst.entity_internal = (EntityInternal*)SV_ALLOCATE_MEMORY(sizeof(EntityInternal) * capacity, "Scene");
+				dst.entity_misc = (EntityMisc*)SV_ALLOCATE_MEMORY(sizeof(EntityMisc) * capacity, "Scene");
+				dst.entity_transform = (EntityTransform*)SV_ALLOCATE_MEMORY(sizeof(EntityTransform) * capacity, "Scene");
+
+				memcpy(dst.entity_internal, src.entity_internal, sizeof(EntityInternal) * capacity);
+				memcpy(dst.entity_misc, src.entity_misc, sizeof(EntityMisc) * capacity);
+				memcpy(dst.entity_transform, src.entity_transform, sizeof(EntityTransform) * capacity);
+			}
+
+			dst.entity_hierarchy = src.entity_hierarchy;
+			dst.hierarchy_dirty = src.hierarchy_dirty;
+			dst.first_root = src.first_root;
+			dst.last_root = src.last_root;
+			dst.entity_free_list = src.entity_free_list;
 		}
 
-		ecs.entity_capacity = new_entity_capacity;
-		
-		ecs.entity_internal = new_internal;
-		ecs.entity_misc = new_misc;
-		ecs.entity_transform = new_transform;
-	}
+		// Prefabs
+		{
+			foreach(i, src.prefab_size) {
 
-	Entity create_entity(Entity parent, const char* name, Entity prefab_entity)
-	{
-		SV_ECS();
+				const EntityPrefab& s = src.prefabs[i];
+				EntityPrefab& d = dst.prefabs[i];
+				
+				d.entities = s.entities;
+				string_copy(d.filepath, s.filepath, FILEPATH_SIZE + 1u);
+				d.entity = s.entity;
+			}
 
-		SV_ASSERT(parent == 0u || entity_exists(parent));
+			dst.prefab_table.clear();
+			dst.prefab_table.insert(src.prefab_table);
+			dst.prefab_size = src.prefab_size;
+			dst.prefab_free = src.prefab_free;
+		}
 
-		EntityPrefab* prefab = NULL;
-		if (entity_exists(prefab_entity)) {
-			prefab = ecs.entity_internal[prefab_entity - 1u].own_prefab;
+		// Tags
+		foreach(i, TAG_MAX) {
 
-			if (prefab == NULL) {
-				SV_LOG_ERROR("The entity isn't a prefab");
-				return 0;
+			dst.tags[i].entities = src.tags[i].entities;
+			dst.tags[i].sparse = src.tags[i].sparse;
+		}
+
+		// Component pools
+		for (CompID id = 0u; id < COMPONENT_MAX; ++id) {
+
+			const ComponentAllocator& s = src.component_allocator[id];
+			ComponentAllocator& d = dst.component_allocator[id];
+			u32 size = scene_state->component_register[id].size;
+
+			d.pool_count = s.pool_count;
+			d.free_list = s.free_list;
+			d.archetypes = s.archetypes;
+
+			foreach(i, s.pool_count) {
+
+				const ComponentPool& sp = s.pools[i];
+				ComponentPool& dp = d.pools[i];
+
+				dp.count = sp.count;
+				dp.capacity = sp.capacity;
+				dp.free_count = sp.free_count;
+				dp.data = (u8*)SV_ALLOCATE_MEMORY(size_t(size) * size_t(sp.capacity), "Scene");
+				memcpy(dp.data, sp.data, size_t(size) * size_t(sp.count));
 			}
 		}
 
-		// Allocate entity
-		Entity entity;
-		
-		if (ecs.entity_free_list.size()) {
+		// Archetypes
+		{
+			dst.archetypes.resize(src.archetypes.size());
+
+			foreach(i, src.archetypes.size()) {
+
+				const Archetype& s = src.archetypes[i];
+				Archetype& d = dst.archetypes[i];
+
+				d = s;
+
+				foreach(j, s.chunks.size()) {
+					d.chunks[j] = (u8*)SV_ALLOCATE_MEMORY(s.chunk_size, "Scene");
+					memcpy(d.chunks[j], s.chunks[j], s.chunk_size);
+				}
+
+				// The pointer columns reference the pools of src
+				foreach(c, d.column_count) {
+
+					const ArchetypeColumn& column = d.columns[c];
+					if (column.is_inline) continue;
+
+					u32 size = scene_state->component_register[column.comp_id].size;
+
+					foreach(row, d.count) {
+
+						Component** ptr = reinterpret_cast<Component**>(get_archetype_data(d, c, row));
+						*ptr = rebase_pool_component(src.component_allocator[column.comp_id], dst.component_allocator[column.comp_id], size, *ptr);
+					}
+				}
+			}
+
+			dst.archetype_table.clear();
+			dst.archetype_table.insert(src.archetype_table);
 
-			entity = ecs.entity_free_list.back() - 1u;
-			ecs.entity_free_list.pop_back();
+			dst.queries.resize(src.queries.size());
+
+			foreach(i, src.queries.size())
+				dst.queries[i] = src.queries[i];
 		}
-		else {
 
-			entity = ecs.entity_size;
+		// Entity references
+		foreach(i, dst.entity_size) {
+
+			EntityInternal& internal = dst.entity_internal[i];
+
+			if (internal.hierarchy_index == u32_max) {
+				internal.own_prefab = NULL;
+				internal.mirrors = NULL;
+				continue;
+			}
+
+			if (internal.own_prefab)
+				internal.own_prefab = dst.prefabs + (internal.own_prefab - src.prefabs);
+
+			if (internal.mirrors) {
+				EntityMirrorBlock* block = SV_ALLOCATE_STRUCT(EntityMirrorBlock, "Scene");
+				block->overrides = internal.mirrors->overrides;
+				block->relative_matrix = internal.mirrors->relative_matrix;
+				block->version = internal.mirrors->version;
+				block->dirty = internal.mirrors->dirty;
+				internal.mirrors = block;
+			}
+
+			foreach(j, internal.component_count) {
 
-			if (ecs.entity_size == ecs.entity_capacity) {
+				CompRef& ref = internal.components[j];
 
-				allocate_entities();
+				if (!is_archetype_component(ref.comp_id))
+					ref.comp = rebase_pool_component(src.component_allocator[ref.comp_id], dst.component_allocator[ref.comp_id], scene_state->component_register[ref.comp_id].size, ref.comp);
 			}
 
-			++ecs.entity_size;
+			if (internal.archetype != u32_max)
+				update_archetype_refs(internal, dst.archetypes[internal.archetype]);
+		}
+
+		// Spatial index
+		{
+			dst.spatial_cells.clear();
+			dst.spatial_cells.insert(src.spatial_cells);
+			dst.spatial_large = src.spatial_large;
+			dst.spatial_dirty = src.spatial_dirty;
+			dst.spatial_3D = src.spatial_3D;
+			dst.spatial_min = src.spatial_min;
+			dst.spatial_max = src.spatial_max;
 		}
-		
-		EntityInternal& internal = ecs.entity_internal[entity];
-		++entity;
 
-		if (parent) {
+		dst.mirror_version = src.mirror_version;
 
-			// notify parents
-			{
-				Entity aux = parent;
+		// The pending commands aren't part of the snapshot
+		dst.command_buffers.resize(task_thread_count());
+	}
 
-				while (aux != 0) {
-				
-					EntityInternal& parent_to_update = ecs.entity_internal[aux - 1u];
-					++parent_to_update.child_count;
-					aux = parent_to_update.parent;
+	// Releases the memory of a copied ECS without destroying the components
+	SV_AUX void free_ecs_copy(ECS& ecs)
+	{
+		for (CompID id = 0u; id < COMPONENT_MAX; ++id) {
+
+			ComponentAllocator& alloc = ecs.component_allocator[id];
+
+			foreach(i, alloc.pool_count)
+				SV_FREE_MEMORY(alloc.pools[i].data);
+
+			alloc.pool_count = 0u;
+		}
+
+		for (Archetype& archetype : ecs.archetypes) {
+			for (u8* chunk : archetype.chunks)
+				SV_FREE_MEMORY(chunk);
+		}
+
+		if (ecs.entity_internal) {
+
+			foreach(i, ecs.entity_size)
+				free_mirror_block(ecs.entity_internal[i]);
+
+			SV_FREE_MEMORY(ecs.entity_internal);
+			SV_FREE_MEMORY(ecs.entity_misc);
+			SV_FREE_MEMORY(ecs.entity_transform);
+			ecs.entity_internal = NULL;
+			ecs.entity_misc = NULL;
+			ecs.entity_transform = NULL;
+		}
+	}
+
+	// Iterates the live components of two ECS with the same memory layout, the order is the same in both
+	template<typename Fn>
+	SV_AUX void foreach_copied_component(ECS& dst, ECS& src, Fn fn)
+	{
+		for (CompID id = 0u; id < scene_state->component_register_count; ++id) {
+
+			ComponentAllocator& dst_alloc = dst.component_allocator[id];
+			ComponentAllocator& src_alloc = src.component_allocator[id];
+			u32 size = scene_state->component_register[id].size;
+
+			foreach(i, src_alloc.pool_count) {
+
+				ComponentPool& dst_pool = dst_alloc.pools[i];
+				ComponentPool& src_pool = src_alloc.pools[i];
+
+				foreach(j, src_pool.count) {
+
+					size_t offset = size_t(j) * size_t(size);
+					Component* comp = reinterpret_cast<Component*>(src_pool.data + offset);
+					if (comp->id != 0u) fn(id, reinterpret_cast<Component*>(dst_pool.data + offset), comp);
 				}
 			}
+		}
+
+		foreach(a, src.archetypes.size()) {
 
-			EntityInternal& parent_internal = ecs.entity_internal[parent - 1u];
+			Archetype& dst_archetype = dst.archetypes[a];
+			Archetype& src_archetype = src.archetypes[a];
 
-			u32 index = parent_internal.hierarchy_index + parent_internal.child_count;
-			ecs.entity_hierarchy.insert(entity, index);
+			foreach(i, src_archetype.column_count) {
 
-			for (u32 i = index + 1u; i < ecs.entity_hierarchy.size(); ++i) {
+				const ArchetypeColumn& column = src_archetype.columns[i];
+				if (!column.is_inline) continue;
 
-				Entity e = ecs.entity_hierarchy[i] - 1u;
-				++ecs.entity_internal[e].hierarchy_index;
+				foreach(row, src_archetype.count) {
+
+					Component* comp = get_archetype_component(src_archetype, i, row);
+					if (comp->id != 0u) fn(column.comp_id, get_archetype_component(dst_archetype, i, row), comp);
+				}
 			}
+		}
+	}
+
+	// Copies the components of src in the bitwise copy dst. The components without snapshot function are serialized
+	// when the snapshot is taken and rebuilt from the serialized data when is restored
+	SV_AUX void snapshot_components(ECS& dst, ECS& src, Serializer* s, Deserializer* d)
+	{
+		foreach_copied_component(dst, src, [s, d](CompID comp_id, Component* dst_comp, Component* src_comp) {
 
-			internal.hierarchy_index = index;
-			internal.parent = parent;
+			ComponentRegister& reg = scene_state->component_register[comp_id];
 
-			if (is_prefab(parent) || ecs.entity_misc[parent - 1].flags & EntityFlag_PrefabChild) {
-				ecs.entity_misc[entity - 1].flags |= EntityFlag_PrefabChild;
+			if (reg.snapshot_fn) reg.snapshot_fn(dst_comp, src_comp);
+			else if (s) serialize_component(comp_id, src_comp, *s);
+			else {
+				// The bitwise copy can contain references to assets or resources that are already released
+				u32 id = dst_comp->id;
+				reg.create_fn(dst_comp, id & ~SV_BIT(31));
+				dst_comp->id = id;
+				
+				deserialize_component(comp_id, dst_comp, *d, reg.version);
 			}
+		});
+	}
+
+	SceneSnapshot* scene_snapshot_take()
+	{
+		if (!there_is_scene()) {
+			SV_LOG_ERROR("Can't take a snapshot without scene");
+			return NULL;
 		}
-		else {
+		
+		SV_ECS();
 
-			internal.hierarchy_index = u32(ecs.entity_hierarchy.size());
-			ecs.entity_hierarchy.push_back(entity);
+		// The hierarchy index is used to know which entities are alive
+		update_hierarchy();
+
+		SceneSnapshot* snapshot = SV_ALLOCATE_STRUCT(SceneSnapshot, "Scene");
+
+		string_copy(snapshot->name, scene.name, SCENE_NAME_SIZE + 1u);
+		snapshot->data = scene.data;
+
+		copy_ecs(snapshot->ecs, ecs);
+		snapshot_components(snapshot->ecs, ecs, &snapshot->components, NULL);
+
+		return snapshot;
+	}
+
+	bool scene_snapshot_restore(SceneSnapshot* snapshot)
+	{
+		if (snapshot == NULL || !there_is_scene())
+			return false;
+		
+		SV_ECS();
+
+		if (strcmp(snapshot->name, scene.name) != 0) {
+			SV_LOG_ERROR("The snapshot of the scene '%s' can't be restored in '%s'", snapshot->name, scene.name);
+			return false;
 		}
 
-		if (name)
-			string_copy(ecs.entity_misc[entity - 1u].name, name, ENTITY_NAME_SIZE + 1u);
+		// The handles of the live entities must not be valid for the restored ones
+		List<u32> generations;
+		generations.resize(ecs.entity_capacity);
 
-		if (prefab) {
+		foreach(i, ecs.entity_capacity)
+			generations[i] = ecs.entity_internal[i].generation;
 
-			internal.prefab = prefab_entity;
-			prefab->entities.push_back(entity);
+		close_ecs();
 
-			const EntityTransform& prefab_transform = ecs.entity_transform[prefab_entity - 1];
-			EntityTransform& transform = ecs.entity_transform[entity - 1];
+		copy_ecs(ecs, snapshot->ecs);
+		scene.data = snapshot->data;
 
-			transform.position = prefab_transform.position;
-			transform.rotation = prefab_transform.rotation;
-			transform.scale = prefab_transform.scale;
+		if (ecs.entity_capacity < generations.size())
+			reserve_entities(u32(generations.size()));
 
-			if (name == NULL) {
+		foreach(i, generations.size()) {
 
-				const EntityMisc& prefab_misc = ecs.entity_misc[prefab_entity - 1];
-				EntityMisc& misc = ecs.entity_misc[entity - 1];
-				string_copy(misc.name, prefab_misc.name, ENTITY_NAME_SIZE + 1);
-			}
+			u32& generation = ecs.entity_internal[i].generation;
+			u32 live = generations[i];
+
+			if (generation != live)
+				generation = SV_MAX(generation, live) + 1u;
 		}
 
-		EntityCreateEvent e;
-		e.entity = entity;
-		event_dispatch("on_entity_create", &e);
+		Deserializer d;
+		d.serializer_version = Serializer::VERSION;
+		d.engine_version = engine.version;
+		d.buff.write_back(snapshot->components.buff.data(), snapshot->components.buff.size());
+		d.pos = 0u;
+		
+		snapshot_components(ecs, snapshot->ecs, NULL, &d);
 
-		return entity;
+		deserialize_end(d);
+
+		update_hierarchy();
+
+		if (ecs.entity_hierarchy.size())
+			dispatch_entities_create(ecs.entity_hierarchy.data(), u32(ecs.entity_hierarchy.size()));
+
+		return true;
 	}
-	
-	void destroy_entity(Entity entity)
+
+	void scene_snapshot_free(SceneSnapshot* snapshot)
 	{
-		entity = get_reflected_entity(entity);
+		if (snapshot) {
+
+			// Only the copied components are owned by the snapshot
+			foreach_copied_component(snapshot->ecs, snapshot->ecs, [](CompID comp_id, Component* comp, Component*) {
+
+				ComponentRegister& reg = scene_state->component_register[comp_id];
+				if (reg.snapshot_fn) reg.destroy_fn(comp, 0);
+			});
+			
+			free_ecs_copy(snapshot->ecs);
+			SV_FREE_STRUCT(snapshot);
+		}
+	}
+
+	SV_AUX void reserve_entities(u32 min_capacity)
+	{
+		SV_ECS();
+
+		u32 new_entity_capacity = SV_MAX(ecs.entity_capacity * 2u, ecs.entity_capacity + ENTITY_ALLOCATION_POOL);
+		new_entity_capacity = SV_MAX(new_entity_capacity, min_capacity);
+		u32 new_count = new_entity_capacity - ecs.entity_capacity;
+		
+		EntityInternal* new_internal = (EntityInternal*) SV_ALLOCATE_MEMORY(sizeof(EntityInternal) * new_entity_capacity, "Scene");
+		EntityMisc* new_misc = (EntityMisc*) SV_ALLOCATE_MEMORY(sizeof(EntityMisc) * new_entity_capacity, "Scene");
+		EntityTransform* new_transform = (EntityTransform*) SV_ALLOCATE_MEMORY(sizeof(EntityTransform) * new_entity_capacity, "Scene");
+
+		if (ecs.entity_capacity) {
+
+			memcpy(new_internal, ecs.entity_internal, sizeof(EntityInternal) * ecs.entity_capacity);
+			memcpy(new_misc, ecs.entity_misc, sizeof(EntityMisc) * ecs.entity_capacity);
+			memcpy(new_transform, ecs.entity_transform, sizeof(EntityTransform) * ecs.entity_capacity);
+
+			SV_FREE_MEMORY(ecs.entity_internal);
+			SV_FREE_MEMORY(ecs.entity_misc);
+			SV_FREE_MEMORY(ecs.entity_transform);
+		}
+
+		foreach(i, new_count) {
+
+			EntityInternal& e = new_internal[i + ecs.entity_capacity];
+			initialize_entity_internal(e);
+			e.generation = 0u;
+		}
+		foreach(i, new_count) {
+
+			EntityMisc& e = new_misc[i + ecs.entity_capacity];
+			initialize_entity_misc(e);
+		}
+		foreach(i, new_count) {
+
+			EntityTransform& e = new_transform[i + ecs.entity_capacity];
+			initialize_entity_transform(e);
+		}
+
+		ecs.entity_capacity = new_entity_capacity;
 		
+		ecs.entity_internal = new_internal;
+		ecs.entity_misc = new_misc;
+		ecs.entity_transform = new_transform;
+	}
+
+	SV_AUX bool allocate_entities(u32 count, Entity parent, const char* name, Entity prefab_entity, Entity* entities)
+	{
 		SV_ECS();
-		SV_ASSERT(entity_exists(entity));
 
-		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		SV_ASSERT(parent == 0u || entity_exists(parent));
 
-		u32 count = internal.child_count + 1;
+		EntityPrefab* prefab = NULL;
+		if (entity_exists(prefab_entity)) {
+			prefab = ecs.entity_internal[prefab_entity - 1u].own_prefab;
 
-		// data to remove entities
-		size_t index_begin_dst = internal.hierarchy_index;
-		size_t index_begin_src= internal.hierarchy_index + count;
-		size_t cpy_cant = (u32)ecs.entity_hierarchy.size() - index_begin_src;
+			if (prefab == NULL) {
+				SV_LOG_ERROR("The entity isn't a prefab");
+				return false;
+			}
+		}
 
-		// Dispatch events
+		// Allocate entities
 		{
-			EntityDestroyEvent e;
+			u32 reused = SV_MIN(u32(ecs.entity_free_list.size()), count);
+			u32 size = ecs.entity_size + count - reused;
 
-			for (size_t i = 0; i < count; ++i) {
-		
-				e.entity = ecs.entity_hierarchy[index_begin_dst + i];
-				event_dispatch("on_entity_destroy", &e);
+			if (size > ecs.entity_capacity)
+				reserve_entities(size);
+
+			foreach(i, count) {
+
+				if (ecs.entity_free_list.size()) {
+
+					entities[i] = ecs.entity_free_list.back();
+					ecs.entity_free_list.pop_back();
+				}
+				else entities[i] = ++ecs.entity_size;
+			}
+		}
+
+		bool prefab_child = parent && (is_prefab(parent) || ecs.entity_misc[parent - 1].flags & EntityFlag_PrefabChild);
+
+		foreach(i, count) {
+
+			Entity entity = entities[i];
+			EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+			// The real index is set when the hierarchy is updated
+			internal.hierarchy_index = 0u;
+			link_entity(entity, parent);
+			mark_spatial_dirty(entity);
+
+			if (prefab_child) {
+				ecs.entity_misc[entity - 1].flags |= EntityFlag_PrefabChild;
+			}
+		}
+
+		foreach(i, count) {
+
+			Entity entity = entities[i];
+
+			if (name)
+				string_copy(ecs.entity_misc[entity - 1u].name, name, ENTITY_NAME_SIZE + 1u);
+
+			if (prefab) {
+
+				ecs.entity_internal[entity - 1u].prefab = prefab_entity;
+				prefab->entities.push_back(entity);
+
+				const EntityTransform& prefab_transform = ecs.entity_transform[prefab_entity - 1];
+				EntityTransform& transform = ecs.entity_transform[entity - 1];
+
+				transform.position = prefab_transform.position;
+				transform.rotation = prefab_transform.rotation;
+				transform.scale = prefab_transform.scale;
+
+				if (name == NULL) {
+
+					const EntityMisc& prefab_misc = ecs.entity_misc[prefab_entity - 1];
+					EntityMisc& misc = ecs.entity_misc[entity - 1];
+					string_copy(misc.name, prefab_misc.name, ENTITY_NAME_SIZE + 1);
+				}
 			}
 		}
 
+		return true;
+	}
+
+	// The batched event and the per entity event are dispatched for all the entities
+	SV_AUX void dispatch_entities_create(const Entity* entities, u32 count)
+	{
+		if (scene_state->entity_events_suspended) return;
+		
+		EntitiesCreateEvent batch;
+		batch.entities = entities;
+		batch.count = count;
+		event_dispatch(scene_state->events.on_entities_create, &batch);
+
+		EntityCreateEvent e;
+
+		foreach(i, count) {
+			e.entity = entities[i];
+			event_dispatch(scene_state->events.on_entity_create, &e);
+		}
+	}
+
+	SV_AUX void dispatch_entities_destroy(const Entity* entities, u32 count)
+	{
+		if (scene_state->entity_events_suspended) return;
+		
+		EntitiesDestroyEvent batch;
+		batch.entities = entities;
+		batch.count = count;
+		event_dispatch(scene_state->events.on_entities_destroy, &batch);
+
+		EntityDestroyEvent e;
+
+		foreach(i, count) {
+			e.entity = entities[i];
+			event_dispatch(scene_state->events.on_entity_destroy, &e);
+		}
+	}
+
+	void suspend_entity_events(bool suspend)
+	{
+		scene_state->entity_events_suspended = suspend;
+	}
+
+	Entity create_entity(Entity parent, const char* name, Entity prefab_entity)
+	{
+		Entity entity;
+
+		if (!allocate_entities(1u, parent, name, prefab_entity, &entity))
+			return 0;
+
+		dispatch_entities_create(&entity, 1u);
+
+		return entity;
+	}
+
+	bool create_entities(u32 count, Entity parent, Entity prefab_entity, Entity* entities)
+	{
+		if (count == 0u) return true;
+
+		if (!allocate_entities(count, parent, NULL, prefab_entity, entities))
+			return false;
+
+		dispatch_entities_create(entities, count);
+
+		return true;
+	}
+	
+	// Releases the tags, the prefab references and the components of the entity
+	SV_AUX void free_entity(Entity entity)
+	{
+		SV_ECS();
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
 		// Remove tag reference
 		if (internal.tag_mask) {
 
 			foreach(i, TAG_MAX) {
 
 				if (internal.tag_mask & SV_BIT(i)) {
-
-					TagInternal& tag = ecs.tags[i];
-
-					u32 index = u32_max;
-					foreach(j, tag.entities.size())
-						if (tag.entities[j] == entity) {
-							index = j;
-							break;
-						}
-
-					if (index != u32_max)
-						tag.entities.erase(index);
-					else SV_ASSERT(0);
+					tag_erase(ecs.tags[i], entity);
 				}
 			}
 		}
@@ -1579,71 +2903,176 @@ namespace sv {
 				}
 			}
 
-			SV_ASSERT(index != u32_max);
-			if (index != u32_max) {
+			SV_ASSERT(index != u32_max);
+			if (index != u32_max) {
+
+				p->entities.erase(index);
+			}
+		}
+
+		free_mirror_block(internal);
+		spatial_remove(entity);
+
+		EntityPrefab* prefab = internal.own_prefab;
+		if (prefab) {
+
+			for (Entity e : prefab->entities) {
+
+				if (entity_exists(e)) {
+
+					EntityInternal& internal = ecs.entity_internal[e - 1];
+					internal.prefab = 0;
+					free_mirror_block(internal);
+				}
+			}
+
+			ecs.prefab_table.erase(prefab->filepath);
+			internal.own_prefab = NULL;
+		}
+
+		// remove components & entityData
+		foreach(j, internal.component_count) {
+				
+			CompRef comp = internal.components[j];
+			free_component(comp);
+		}
+
+		internal.component_count = 0u;
+		internal.component_mask = 0u;
+		archetype_move(entity, internal, 0u);
+
+		u32 generation = internal.generation;
+		initialize_entity_internal(internal);
+		internal.generation = generation + 1u;
+		initialize_entity_misc(ecs.entity_misc[entity - 1u]);
+		initialize_entity_transform(ecs.entity_transform[entity - 1u]);
+
+		if (entity == ecs.entity_size) {
+			--ecs.entity_size;
+		}
+		else {
+			ecs.entity_free_list.push_back(entity);
+		}
+	}
+
+	void destroy_entity(Entity entity)
+	{
+		entity = get_reflected_entity(entity);
+		
+		SV_ECS();
+		SV_ASSERT(entity_exists(entity));
+
+		List<Entity> entities;
+
+		for (Entity e = entity; e != 0; e = next_subtree_entity(entity, e))
+			entities.push_back(e);
+
+		dispatch_entities_destroy(entities.data(), u32(entities.size()));
+
+		unlink_entity(entity);
+
+		for (Entity e : entities)
+			free_entity(e);
+	}
+
+	void destroy_entities(const Entity* entities, u32 count)
+	{
+		SV_ECS();
+
+		List<Entity> roots;
+		roots.reserve(count);
 
-				p->entities.erase(index);
-			}
+		foreach(i, count) {
+
+			Entity entity = get_reflected_entity(entities[i]);
+			if (entity_exists(entity))
+				roots.push_back(entity);
 		}
 
-		EntityPrefab* prefab = internal.own_prefab;
-		if (prefab) {
+		if (roots.empty()) return;
 
-			for (Entity e : prefab->entities) {
+		update_hierarchy();
 
-				if (entity_exists(e)) {
+		// Sort by hierarchy position to discard the entities that are childs of other destroyed entity
+		std::sort(roots.data(), roots.data() + roots.size(), [&ecs](Entity e0, Entity e1) {
+			return ecs.entity_internal[e0 - 1u].hierarchy_index < ecs.entity_internal[e1 - 1u].hierarchy_index;
+		});
 
-					EntityInternal& internal = ecs.entity_internal[e - 1];
-					internal.prefab = 0;
-				}
-			}
+		List<Entity> destroyed;
+		u32 root_count = 0u;
+		u32 subtree_end = 0u;
 
-			ecs.prefab_table.erase(prefab->filepath);
-			internal.own_prefab = NULL;
+		foreach(i, roots.size()) {
+
+			const EntityInternal& internal = ecs.entity_internal[roots[i] - 1u];
+
+			if (root_count && internal.hierarchy_index < subtree_end)
+				continue;
+
+			roots[root_count++] = roots[i];
+			subtree_end = internal.hierarchy_index + internal.child_count + 1u;
+
+			for (u32 j = internal.hierarchy_index; j < subtree_end; ++j)
+				destroyed.push_back(ecs.entity_hierarchy[j]);
 		}
 
-		// notify parents
-		{
-			Entity aux = internal.parent;
+		dispatch_entities_destroy(destroyed.data(), u32(destroyed.size()));
 
-			while (aux != 0) {
-				
-				EntityInternal& parent_to_update = ecs.entity_internal[aux - 1u];
-				parent_to_update.child_count -= count;
-				aux = parent_to_update.parent;
-			}
+		foreach(i, root_count) {
+			unlink_entity(roots[i]);
 		}
 
-		// remove components & entityData
-		for (size_t i = 0; i < count; i++) {
-			
-			Entity e = ecs.entity_hierarchy[index_begin_dst + i];
-			EntityInternal& ed = ecs.entity_internal[e- 1u];
-			
-			foreach(j, ed.component_count) {
-				
-				CompRef comp = ed.components[j];					
-				free_component(comp);
-			}
+		for (Entity e : destroyed)
+			free_entity(e);
+	}
 
-			initialize_entity_internal(ecs.entity_internal[e - 1u]);
-			initialize_entity_misc(ecs.entity_misc[e - 1u]);
-			initialize_entity_transform(ecs.entity_transform[e - 1u]);
+	bool set_entity_parent(Entity entity, Entity parent)
+	{
+		SV_ECS();
+		SV_ASSERT(entity_exists(entity));
+		SV_ASSERT(parent == 0 || entity_exists(parent));
 
-			if (e == ecs.entity_size) {
-				--ecs.entity_size;
-			}
-			else {
-				ecs.entity_free_list.push_back(e);
-			}
+		entity = get_reflected_entity(entity);
+		parent = get_reflected_entity(parent);
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+		if (internal.parent == parent)
+			return true;
+
+		bool is_prefab_child = ecs.entity_misc[entity - 1u].flags & EntityFlag_PrefabChild;
+		bool parent_is_prefab = parent && (is_prefab(parent) || ecs.entity_misc[parent - 1u].flags & EntityFlag_PrefabChild);
+
+		if (is_prefab_child || parent_is_prefab) {
+			SV_LOG_ERROR("Can't change the parent of a prefab entity");
+			return false;
 		}
 
-		// remove from entities & update indices
-		if (cpy_cant != 0) memcpy(&ecs.entity_hierarchy[index_begin_dst], &ecs.entity_hierarchy[index_begin_src], cpy_cant * sizeof(Entity));
-		ecs.entity_hierarchy.resize((u32)ecs.entity_hierarchy.size() - count);
-		for (size_t i = index_begin_dst; i < ecs.entity_hierarchy.size(); ++i) {
-			ecs.entity_internal[ecs.entity_hierarchy[i] - 1u].hierarchy_index = (u32)i;
+		for (Entity aux = parent; aux != 0; aux = ecs.entity_internal[aux - 1u].parent) {
+
+			if (aux == entity) {
+				SV_LOG_ERROR("Can't set a child as parent");
+				return false;
+			}
 		}
+
+		Entity old_parent = internal.parent;
+
+		unlink_entity(entity);
+		link_entity(entity, parent);
+
+		// The world matrices of the subtree change, the subtree is only notified if the entity isn't dirty
+		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		t.dirty = false;
+		notify_transform(t, entity);
+
+		EntityParentEvent e;
+		e.entity = entity;
+		e.old_parent = old_parent;
+		e.parent = parent;
+		event_dispatch(scene_state->events.on_entity_parent, &e);
+
+		return true;
 	}
 
 	SV_INTERNAL Entity entity_duplicate_recursive(Entity duplicated, Entity parent, bool is_prefab_child)
@@ -1671,9 +3100,7 @@ namespace sv {
 			foreach(i, TAG_MAX) {
 
 				if (duplicated_internal.tag_mask & SV_BIT(i)) {
-
-					TagInternal& tag = ecs.tags[i];
-					tag.entities.push_back(copy);
+					tag_insert(ecs.tags[i], copy);
 				}
 			}
 
@@ -1687,25 +3114,27 @@ namespace sv {
 			if (p) {
 				copy_internal.prefab = duplicated_internal.prefab;
 				p->entities.push_back(copy);
+
+				if (duplicated_internal.mirrors && duplicated_internal.mirrors->overrides.size())
+					get_mirror_block(copy).overrides = duplicated_internal.mirrors->overrides;
 			}
 		}
 
 		foreach(i, duplicated_internal.component_count) {
 
 			CompID comp_id = duplicated_internal.components[i].comp_id;
-			Component* comp = duplicated_internal.components[i].comp;
+			Component* dst = attach_component(copy, copy_internal, comp_id);
 
-			CompRef& ref = copy_internal.components[copy_internal.component_count++];
-			ref.comp = allocate_component(comp_id);
-			copy_component(comp_id, ref.comp, comp, copy);
-			ref.comp_id = comp_id;
+			// The archetype move can relocate the source component
+			const Component* src = duplicated_internal.components[i].comp;
+			copy_component(comp_id, dst, src, copy);
 		}
-		copy_internal.component_mask = duplicated_internal.component_mask;
 
-		foreach(i, ecs.entity_internal[duplicated - 1u].child_count) {
-			Entity to_copy = ecs.entity_hierarchy[ecs.entity_internal[duplicated - 1].hierarchy_index + i + 1];
+		Entity to_copy = ecs.entity_internal[duplicated - 1u].first_child;
+
+		while (to_copy) {
 			entity_duplicate_recursive(to_copy, copy, is_prefab_child);
-			i += ecs.entity_internal[to_copy - 1u].child_count;
+			to_copy = ecs.entity_internal[to_copy - 1u].next_sibling;
 		}
 
 		return copy;
@@ -1739,6 +3168,30 @@ namespace sv {
 
 		return false;
 	}
+
+	bool entity_exists(EntityHandle handle)
+	{
+		SV_ECS();
+		return entity_exists(handle.entity) && ecs.entity_internal[get_origin_entity(handle.entity) - 1u].generation == handle.generation;
+	}
+
+	EntityHandle get_entity_handle(Entity entity)
+	{
+		SV_ECS();
+		EntityHandle handle;
+		
+		if (entity_exists(entity)) {
+			handle.entity = entity;
+			handle.generation = ecs.entity_internal[get_origin_entity(entity) - 1u].generation;
+		}
+		
+		return handle;
+	}
+
+	Entity get_handle_entity(EntityHandle handle)
+	{
+		return entity_exists(handle) ? handle.entity : 0;
+	}
 	
 	const char* get_entity_name(Entity entity)
 	{
@@ -1776,6 +3229,7 @@ namespace sv {
 		SV_ASSERT(entity_exists(parent));
 
 		parent = get_reflected_entity(parent);
+		update_hierarchy();
 
 		EntityInternal& internal = ecs.entity_internal[parent - 1u];
 		
@@ -1788,6 +3242,7 @@ namespace sv {
 		SV_ASSERT(entity_exists(parent));
 
 		parent = get_reflected_entity(parent);
+		update_hierarchy();
 		
 		const EntityInternal& internal = ecs.entity_internal[parent - 1u];
 
@@ -1856,12 +3311,14 @@ namespace sv {
     u32 get_entity_count()
 	{
 		SV_ECS();
+		update_hierarchy();
 		return (u32)ecs.entity_hierarchy.size();
 	}
 	
     Entity get_entity_by_index(u32 index)
 	{
 		SV_ECS();
+		update_hierarchy();
 		return ecs.entity_hierarchy[index];
 	}
 
@@ -1914,19 +3371,12 @@ namespace sv {
 			return NULL;
 		}
 
-		Component* component = allocate_component(comp_id);
+		Component* component = attach_component(entity, internal, comp_id);
 		
 		create_component(comp_id, component, entity);
 
-		internal.components[internal.component_count].comp_id = comp_id;
-		internal.components[internal.component_count].comp = component;
-
 		if (is_prefab(entity))
 			component->id |= SV_BIT(31);
-		
-		++internal.component_count;
-
-		internal.component_mask |= SV_BIT(comp_id);
 
 		return component;
 	}
@@ -1942,34 +3392,21 @@ namespace sv {
 
 		if (internal.component_mask & SV_BIT(comp_id)) {
 
-			internal.component_mask &= ~SV_BIT(comp_id);
-
-			CompRef comp_ref;
-			comp_ref.comp = NULL;
-			u32 component_index = 0u;
+			u32 component_index = u32_max;
 
 			foreach(i, internal.component_count) {
 				
-				const CompRef& c = internal.components[i];
-
-				if (c.comp_id == comp_id) {
-					comp_ref = c;
+				if (internal.components[i].comp_id == comp_id) {
 					component_index = i;
 					break;
 				}
 			}
 
-			SV_ASSERT(comp_ref.comp);
-
-			if (comp_ref.comp) {
-
-				for (u32 i = component_index + 1u; i < internal.component_count; ++i) {
-					internal.components[i - 1u] = internal.components[i];
-				}
-				--internal.component_count;
+			SV_ASSERT(component_index != u32_max);
 
-				free_component(comp_ref);
-			}			
+			if (component_index != u32_max) {
+				detach_component(entity, internal, component_index);
+			}
 		}
 	}
 	
@@ -1991,14 +3428,343 @@ namespace sv {
 				}
 			}
 
-			SV_ASSERT(0);
-			return NULL;
-		}
-		else if (internal.prefab) {
-			return get_entity_component(internal.prefab, comp_id);
+			SV_ASSERT(0);
+			return NULL;
+		}
+		else if (internal.prefab) {
+			return get_entity_component(internal.prefab, comp_id);
+		}
+
+		return NULL;
+	}
+
+	Component* get_entity_component_mut(Entity entity, CompID comp_id)
+	{
+		Component* comp = get_entity_component(entity, comp_id);
+		if (comp) mark_component_changed(entity, comp_id);
+		return comp;
+	}
+
+	void mark_component_changed(Entity entity, CompID comp_id)
+	{
+		SV_ECS();
+		SV_ASSERT(entity_exists(entity));
+
+		entity = get_reflected_entity(entity);
+
+		const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+		if (internal.component_mask & (1ULL << (u64)comp_id)) {
+
+			if (internal.archetype != u32_max) {
+				
+				Archetype& archetype = ecs.archetypes[internal.archetype];
+				mark_chunk_changed(archetype, internal.archetype_row, find_archetype_column(archetype, comp_id));
+			}
+		}
+		else if (internal.prefab) {
+			mark_component_changed(internal.prefab, comp_id);
+		}
+	}
+
+	void get_removed_components(CompID comp_id, u64 frame, List<Entity>& entities)
+	{
+		SV_ECS();
+
+		entities.reset();
+		if (!component_exists(comp_id)) return;
+
+		const List<ComponentRemoval>& removals = ecs.component_allocator[comp_id].removals;
+
+		for (const ComponentRemoval& r : removals) {
+			if (r.frame >= frame) entities.push_back(r.entity);
+		}
+	}
+
+	SV_AUX void free_old_removals()
+	{
+		SV_ECS();
+
+		for (CompID id = 0u; id < scene_state->component_register_count; ++id) {
+
+			List<ComponentRemoval>& removals = ecs.component_allocator[id].removals;
+			u32 count = 0u;
+
+			while (count < removals.size() && removals[count].frame + COMPONENT_REMOVAL_FRAMES < engine.frame_count)
+				++count;
+
+			if (count) {
+				foreach(i, removals.size() - count)
+					removals[i] = removals[i + count];
+				removals.pop_back(count);
+			}
+		}
+	}
+
+	//////////////////////////////////////////// COMMAND BUFFERS ////////////////////////////////////////////////////////
+
+	SV_AUX EntityCommandBuffer& get_command_buffer()
+	{
+		SV_ECS();
+		
+		// The threads that aren't created by the task system don't have a buffer
+		u32 thread = task_thread_index();
+		SV_ASSERT(thread < ecs.command_buffers.size());
+		
+		return ecs.command_buffers[thread];
+	}
+
+	SV_AUX u32 push_command_data(EntityCommandBuffer& buffer, const void* src, u32 size)
+	{
+		u32 offset = (u32(buffer.data.size()) + 15u) & ~15u;
+		buffer.data.resize(offset + size);
+
+		if (src) memcpy(buffer.data.data() + offset, src, size);
+		return offset;
+	}
+
+	SV_AUX void push_command(EntityCommandBuffer& buffer, EntityCommandType type, Entity entity, CompID comp_id, u32 data)
+	{
+		EntityCommand& cmd = buffer.commands.emplace_back();
+		cmd.type = type;
+		cmd.entity = entity;
+		cmd.parent = 0;
+		cmd.prefab = 0;
+		cmd.comp_id = comp_id;
+		cmd.data = data;
+	}
+
+	SV_AUX bool is_deferred_entity(Entity entity)
+	{
+		return (entity & DEFERRED_ENTITY_MASK) == DEFERRED_ENTITY_MASK;
+	}
+
+	// Returns 0 if the entity isn't created yet, only valid in the playback
+	SV_AUX Entity resolve_entity(Entity entity)
+	{
+		SV_ECS();
+
+		if (is_deferred_entity(entity)) {
+
+			u32 thread = (entity >> 16u) & 0xFF;
+			u32 index = entity & DEFERRED_ENTITY_MAX;
+
+			if (thread < ecs.playback_buffers.size()) {
+
+				const EntityCommandBuffer& buffer = ecs.playback_buffers[thread];
+				if (index < buffer.created.size()) return buffer.created[index];
+			}
+
+			return 0;
+		}
+
+		return entity;
+	}
+
+	Entity defer_create_entity(Entity parent, const char* name, Entity prefab)
+	{
+		EntityCommandBuffer& buffer = get_command_buffer();
+		
+		if (buffer.create_count > DEFERRED_ENTITY_MAX) {
+			SV_LOG_ERROR("Can't defer more than %u entity creations per thread", DEFERRED_ENTITY_MAX + 1u);
+			return 0;
+		}
+
+		u32 data = u32_max;
+		if (name) data = push_command_data(buffer, name, string_size(name) + 1u);
+
+		Entity entity = DEFERRED_ENTITY_MASK | (task_thread_index() << 16u) | buffer.create_count++;
+
+		push_command(buffer, EntityCommandType_CreateEntity, entity, 0u, data);
+
+		EntityCommand& cmd = buffer.commands.back();
+		cmd.parent = parent;
+		cmd.prefab = prefab;
+
+		return entity;
+	}
+	
+	void defer_destroy_entity(Entity entity)
+	{
+		push_command(get_command_buffer(), EntityCommandType_DestroyEntity, entity, 0u, u32_max);
+	}
+	
+	void defer_add_component(Entity entity, CompID comp_id)
+	{
+		push_command(get_command_buffer(), EntityCommandType_AddComponent, entity, comp_id, u32_max);
+	}
+	
+	void defer_remove_component(Entity entity, CompID comp_id)
+	{
+		push_command(get_command_buffer(), EntityCommandType_RemoveComponent, entity, comp_id, u32_max);
+	}
+	
+	void defer_set_component(Entity entity, CompID comp_id, const Component* src)
+	{
+		SV_ASSERT(component_exists(comp_id));
+		
+		EntityCommandBuffer& buffer = get_command_buffer();
+		const ComponentRegister& reg = scene_state->component_register[comp_id];
+
+		// The data is copied now, the source can be modified or destroyed before the playback
+		u32 data = push_command_data(buffer, NULL, reg.size);
+		Component* comp = reinterpret_cast<Component*>(buffer.data.data() + data);
+		
+		reg.create_fn(comp, 0);
+		reg.copy_fn(comp, src, 0);
+
+		push_command(buffer, EntityCommandType_SetComponent, entity, comp_id, data);
+	}
+
+	// Returns false if the deferred parent or prefab isn't created yet, they can be recorded in other buffer
+	SV_AUX bool play_create_command(EntityCommandBuffer& buffer, const EntityCommand& cmd, bool force)
+	{
+		Entity parent = resolve_entity(cmd.parent);
+		Entity prefab = resolve_entity(cmd.prefab);
+
+		if (!force && ((cmd.parent && parent == 0) || (cmd.prefab && prefab == 0)))
+			return false;
+
+		const char* name = (cmd.data == u32_max) ? NULL : reinterpret_cast<const char*>(buffer.data.data() + cmd.data);
+		
+		Entity entity = create_entity(entity_exists(parent) ? parent : 0, name, entity_exists(prefab) ? prefab : 0);
+		buffer.created[cmd.entity & DEFERRED_ENTITY_MAX] = entity;
+		return true;
+	}
+
+	struct EntityCreateCommand {
+		EntityCommandBuffer* buffer;
+		const EntityCommand* cmd;
+	};
+
+	SV_AUX void play_command_buffers(List<EntityCommandBuffer>& buffers)
+	{
+		// The entities are created first, the other commands can reference them from any thread.
+		// A deferred parent can be recorded in a later buffer, the creations are repeated until all the parents exist
+		List<EntityCreateCommand> creates;
+
+		for (EntityCommandBuffer& buffer : buffers) {
+
+			buffer.created.resize(buffer.create_count, 0);
+
+			for (const EntityCommand& cmd : buffer.commands) {
+
+				if (cmd.type == EntityCommandType_CreateEntity) {
+					EntityCreateCommand& c = creates.emplace_back();
+					c.buffer = &buffer;
+					c.cmd = &cmd;
+				}
+			}
+		}
+
+		while (creates.size()) {
+
+			u32 count = 0u;
+
+			foreach(i, creates.size()) {
+
+				EntityCreateCommand c = creates[i];
+				if (!play_create_command(*c.buffer, *c.cmd, false))
+					creates[count++] = c;
+			}
+
+			// The remaining parents are invalid, the entities are created in the root
+			if (count == creates.size()) {
+
+				for (const EntityCreateCommand& c : creates)
+					play_create_command(*c.buffer, *c.cmd, true);
+				count = 0u;
+			}
+
+			creates.resize(count);
+		}
+
+		for (EntityCommandBuffer& buffer : buffers) {
+
+			foreach(i, buffer.commands.size()) {
+
+				EntityCommand cmd = buffer.commands[i];
+				Entity entity = resolve_entity(cmd.entity);
+
+				switch (cmd.type) {
+
+				case EntityCommandType_DestroyEntity:
+					if (entity_exists(entity)) destroy_entity(entity);
+					break;
+
+				case EntityCommandType_AddComponent:
+					if (entity_exists(entity) && !has_entity_component(entity, cmd.comp_id))
+						add_entity_component(entity, cmd.comp_id);
+					break;
+
+				case EntityCommandType_RemoveComponent:
+					if (entity_exists(entity)) remove_entity_component(entity, cmd.comp_id);
+					break;
+
+				case EntityCommandType_SetComponent:
+				{
+					const ComponentRegister& reg = scene_state->component_register[cmd.comp_id];
+					
+					if (entity_exists(entity)) {
+
+						Component* comp = get_entity_component_mut(entity, cmd.comp_id);
+						if (comp == NULL) comp = add_entity_component(entity, cmd.comp_id);
+
+						if (comp) {
+
+							u32 id = comp->id;
+							const Component* src = reinterpret_cast<const Component*>(buffer.data.data() + cmd.data);
+							reg.copy_fn(comp, src, entity);
+							comp->id = id;
+						}
+					}
+
+					Component* src = reinterpret_cast<Component*>(buffer.data.data() + cmd.data);
+					reg.destroy_fn(src, 0);
+					buffer.commands[i].data = u32_max;
+				}
+				break;
+
+				default:
+					break;
+				
+				}
+			}
+		}
+	}
+
+	constexpr u32 ENTITY_COMMAND_ROUNDS_MAX = 16u;
+
+	void play_entity_commands()
+	{
+		SV_ECS();
+
+		// The buffers are swapped before the playback, the commands recorded from the events are executed in the next round
+		foreach(round, ENTITY_COMMAND_ROUNDS_MAX) {
+
+			bool empty = true;
+
+			for (const EntityCommandBuffer& buffer : ecs.command_buffers) {
+				if (buffer.commands.size()) {
+					empty = false;
+					break;
+				}
+			}
+
+			if (empty) return;
+
+			List<EntityCommandBuffer> aux = std::move(ecs.playback_buffers);
+			ecs.playback_buffers = std::move(ecs.command_buffers);
+			ecs.command_buffers = std::move(aux);
+			ecs.command_buffers.resize(ecs.playback_buffers.size());
+
+			play_command_buffers(ecs.playback_buffers);
+
+			for (EntityCommandBuffer& buffer : ecs.playback_buffers)
+				reset_command_buffer(buffer);
 		}
 
-		return NULL;
+		SV_LOG_WARNING("The entity commands are recorded recursively, the remaining commands are executed in the next update");
 	}
 
 	bool has_entity_tag(Entity entity, Tag tag)
@@ -2036,9 +3802,7 @@ namespace sv {
 				if (!(internal.tag_mask & SV_BIT(tag))) {
 
 					internal.tag_mask |= SV_BIT(tag);
-
-					TagInternal& tag_internal = ecs.tags[tag];
-					tag_internal.entities.push_back(entity);
+					tag_insert(ecs.tags[tag], entity);
 				}
 			}
 		}
@@ -2058,25 +3822,16 @@ namespace sv {
 		if (internal.tag_mask & SV_BIT(tag)) {
 
 			internal.tag_mask = internal.tag_mask & ~SV_BIT(tag);
-
-			TagInternal& tag_internal = ecs.tags[tag];
-
-			foreach(i, tag_internal.entities.size()) {
-				if (tag_internal.entities[i] == entity) {
-					tag_internal.entities.erase(i);
-					return;
-				}
-			}
-
-			SV_ASSERT(0);
+			tag_erase(ecs.tags[tag], entity);
 		}
 	}
 
-	SV_AUX bool deserialize_components(Deserializer& d, u32& component_count, u64& component_mask, CompRef* components, Entity entity)
+	SV_AUX bool deserialize_components(Deserializer& d, EntityInternal& internal, Entity entity)
 	{
 		u32 version;
 		deserialize_u32(d, version);
-		
+
+		u32 component_count;
 		deserialize_u32(d, component_count);
 
 		if (component_count > ENTITY_COMPONENTS_MAX) {
@@ -2086,28 +3841,23 @@ namespace sv {
 
 		foreach(i, component_count) {
 
-			CompRef& ref = components[i];
-
 			char comp_name[COMPONENT_NAME_SIZE + 1u];
 			u32 comp_version;
 
 			deserialize_string(d, comp_name, COMPONENT_NAME_SIZE + 1u);
 			deserialize_u32(d, comp_version);
 
-			ref.comp_id = get_component_id(comp_name);
+			CompID comp_id = get_component_id(comp_name);
 
-			if (ref.comp_id == INVALID_COMP_ID) {
+			if (comp_id == INVALID_COMP_ID) {
 				SV_LOG_ERROR("The component '%s' doesn't exists", comp_name);
 				return false;
 			}
 				
-			ref.comp = allocate_component(ref.comp_id);
-			create_component(ref.comp_id, ref.comp, entity);
+			Component* comp = attach_component(entity, internal, comp_id);
+			create_component(comp_id, comp, entity);
 			
-			deserialize_component(ref.comp_id, ref.comp, d, comp_version);
-
-			component_mask |= SV_BIT(ref.comp_id);
-			components[i] = ref;
+			deserialize_component(comp_id, comp, d, comp_version);
 		}
 
 		return true;
@@ -2185,17 +3935,16 @@ namespace sv {
 			serialize_components(s, internal.component_count, internal.components);
 		}
 
-		for (u32 i = 0u; i < internal.child_count; ++i) {
+		Entity child = internal.first_child;
 
-			Entity child_handle = ecs.entity_hierarchy[internal.hierarchy_index + 1 + i];
-			serialize_entity_internal(s, child_handle);
+		while (child) {
 
-			const EntityInternal& child = ecs.entity_internal[child_handle - 1u];
-			i += child.child_count;
+			serialize_entity_internal(s, child);
+			child = ecs.entity_internal[child - 1u].next_sibling;
 		}
 	}
 
-	static Entity deserialize_entity_prefab(Deserializer& s, Entity parent)
+	static Entity deserialize_entity_prefab(Deserializer& s, Entity parent, u32& entity_count)
 	{
 		SV_ECS();
 
@@ -2254,22 +4003,22 @@ namespace sv {
 		// Components
 		{
 			EntityInternal& internal = ecs.entity_internal[entity - 1];
-			deserialize_components(s, internal.component_count, internal.component_mask, internal.components, entity);
+			deserialize_components(s, internal, entity);
 
 			if (parent == 0)
 				foreach(i, internal.component_count)
 					internal.components[i].comp->id |= SV_BIT(31);
 		}
 
-		for (u32 i = 0u; i < child_count; ++i) {
+		entity_count = 1u;
 
-			Entity child_handle = deserialize_entity_prefab(s, entity);
+		for (u32 i = 0u; i < child_count;) {
 
-			if (entity_exists(child_handle)) {
+			u32 count;
+			deserialize_entity_prefab(s, entity, count);
 
-				const EntityInternal& child = ecs.entity_internal[child_handle - 1u];
-				i += child.child_count;
-			}
+			i += count;
+			entity_count += count;
 		}
 
 		return entity;
@@ -2295,7 +4044,8 @@ namespace sv {
 			u32 version;
 			deserialize_u32(s, version); // VERSION
 
-			prefab = deserialize_entity_prefab(s, 0);
+			u32 entity_count;
+			prefab = deserialize_entity_prefab(s, 0, entity_count);
 
 			deserialize_end(s);
 		}
@@ -2350,8 +4100,17 @@ namespace sv {
 
 		serialize_u32(s, 0); // VERSION
 
+		asset_manifest_begin();
+		
+		update_hierarchy();
 		serialize_entity_internal(s, prefab);
 
+		char manifest_filepath[FILEPATH_SIZE + 1u];
+		string_copy(manifest_filepath, filepath, FILEPATH_SIZE + 1u);
+		string_append(manifest_filepath, ".preload", FILEPATH_SIZE + 1u);
+
+		asset_manifest_end(manifest_filepath);
+
 		if (serialize_end(s, filepath)) {
 
 			SV_LOG_INFO("Prefab saved in '%s'", filepath);
@@ -2438,9 +4197,12 @@ namespace sv {
 
 			if (is_prefab(internal.prefab)) {
 
+				update_hierarchy();
+				
 				EntityInternal& prefab_internal = ecs.entity_internal[internal.prefab - 1];
 
-				if (index < prefab_internal.child_count) {
+				// The last index is reserved for the deferred entities
+				if (index < prefab_internal.child_count && index + 1u < (DEFERRED_ENTITY_MASK >> 24u)) {
 
 					return entity | ((index + 1) << 24);
 				}
@@ -2457,10 +4219,14 @@ namespace sv {
 	{
 		SV_ECS();
 		
+		// The prefab child indices are computed from the hierarchy
+		update_hierarchy();
+		
 		CompIt it;
 		it.flags = flags;
 		it.comp_id = comp_id;
 		it.pool_index = u32_max;
+		it.archetype_row = 0u;
 		it.comp = NULL;
 		it.entity = 0u;
 		it.prefab = 0;
@@ -2469,6 +4235,14 @@ namespace sv {
 
 		ComponentRegister& reg = scene_state->component_register[comp_id];
 		ComponentAllocator& alloc = ecs.component_allocator[comp_id];
+
+		if (reg.flags & ComponentRegisterFlag_Archetype) {
+
+			it.pool_index = 0u;
+			it.has_next = true;
+			comp_it_next(it);
+			return it;
+		}
 		
 		if (alloc.pool_count) {
 
@@ -2486,7 +4260,7 @@ namespace sv {
 
 				ComponentPool* pool = alloc.pools + it.pool_index;
 
-				SV_ASSERT(alloc.pools);
+				SV_ASSERT(pool->data);
 				it.comp = reinterpret_cast<Component*>(pool->data - reg.size);
 			}
 		}
@@ -2528,6 +4302,77 @@ namespace sv {
 		return false;
 	}
 	
+	// Returns true if the iterator should stop in the component
+	SV_AUX bool comp_it_accept(CompIt& it, Component* c)
+	{
+		SV_ECS();
+
+		if (c->id == 0) return false;
+
+		if (it.flags & CompItFlag_Write)
+			mark_component_changed(c->id & ~SV_BIT(31), it.comp_id);
+		
+		if (c->id & SV_BIT(31)) {
+						
+			Entity prefab = c->id & ~SV_BIT(31);
+			return comp_it_init_prefab(it, prefab, 0, c);
+		}
+		else {
+
+			if (ecs.entity_misc[c->id - 1].flags & EntityFlag_PrefabChild) {
+							
+				EntityInternal& entity_internal = ecs.entity_internal[c->id - 1];
+
+				Entity parent = entity_internal.parent;
+				Entity prefab = c->id;
+
+				while (parent != 0) {
+
+					EntityInternal& internal = ecs.entity_internal[parent - 1];
+					prefab = parent;
+					parent = internal.parent;
+				}
+
+				EntityInternal& prefab_internal = ecs.entity_internal[prefab - 1];
+				SV_ASSERT(prefab_internal.own_prefab);
+							
+				u32 child_index = entity_internal.hierarchy_index - prefab_internal.hierarchy_index;
+				return comp_it_init_prefab(it, prefab, child_index, c);
+			}
+			else {
+				it.comp = c;
+				it.entity = c->id;
+				return true;
+			}
+		}
+	}
+
+	SV_AUX void comp_it_next_archetype(CompIt& it)
+	{
+		SV_ECS();
+
+		ComponentAllocator& alloc = ecs.component_allocator[it.comp_id];
+
+		while (it.pool_index < alloc.archetypes.size()) {
+
+			Archetype& archetype = ecs.archetypes[alloc.archetypes[it.pool_index]];
+			u32 column = find_archetype_column(archetype, it.comp_id);
+
+			while (it.archetype_row < archetype.count) {
+
+				Component* c = get_archetype_component(archetype, column, it.archetype_row++);
+
+				if (comp_it_accept(it, c))
+					return;
+			}
+
+			++it.pool_index;
+			it.archetype_row = 0u;
+		}
+
+		it.has_next = false;
+	}
+	
 	void comp_it_next(CompIt& it)
 	{
 		SV_ECS();
@@ -2555,6 +4400,11 @@ namespace sv {
 			ComponentRegister& reg = scene_state->component_register[comp_id];
 			ComponentAllocator& alloc = ecs.component_allocator[comp_id];
 
+			if (reg.flags & ComponentRegisterFlag_Archetype) {
+				comp_it_next_archetype(it);
+				return;
+			}
+
 			u8* comp = (u8*)it.comp;
 			ComponentPool* pool = alloc.pools + it.pool_index;
 
@@ -2580,44 +4430,8 @@ namespace sv {
 					comp = pool->data;
 				}
 
-				Component* c = reinterpret_cast<Component*>(comp);
-
-				if (c->id == 0) continue;
-				else if (c->id & SV_BIT(31)) {
-						
-					Entity prefab = c->id & ~SV_BIT(31);
-					if (comp_it_init_prefab(it, prefab, 0, c))
-						break;
-				}
-				else {
-
-					if (ecs.entity_misc[c->id - 1].flags & EntityFlag_PrefabChild) {
-						
-						EntityInternal& entity_internal = ecs.entity_internal[c->id - 1];
-
-						Entity parent = entity_internal.parent;
-						Entity prefab = c->id;
-
-						while (parent != 0) {
-
-							EntityInternal& internal = ecs.entity_internal[parent - 1];
-							prefab = parent;
-							parent = internal.parent;
-						}
-
-						EntityInternal& prefab_internal = ecs.entity_internal[prefab - 1];
-						SV_ASSERT(prefab_internal.own_prefab);
-						
-						u32 child_index = entity_internal.hierarchy_index - prefab_internal.hierarchy_index;
-						if (comp_it_init_prefab(it, prefab, child_index, c))
-							break;
-					}
-					else {
-						it.comp = c;
-						it.entity = c->id;
-						break;
-					}
-				}
+				if (comp_it_accept(it, reinterpret_cast<Component*>(comp)))
+					break;
 			}
 			while(1);
 		}
@@ -2650,35 +4464,349 @@ namespace sv {
 	{
 		SV_ECS();
 
-		TagInternal& internal = ecs.tags[it.tag];
+		TagInternal& internal = ecs.tags[it.tag];
+
+		if (it.prefab) {
+
+			EntityPrefab& prefab = *ecs.entity_internal[it.prefab - 1].own_prefab;
+			if (it._prefab_index < prefab.entities.size()) {
+
+				it.entity = prefab.entities[it._prefab_index++];
+				return;
+			}
+			else {
+				it.prefab = 0;
+			}
+		}
+
+		++it._index;
+		
+		if (it._index >= internal.entities.size())
+			it.has_next = false;
+		else {
+			it.entity = internal.entities[it._index];
+			if (is_prefab(it.entity)) {
+
+				it.prefab = it.entity;
+				it.entity = 0;
+				it._prefab_index = 0;
+				tag_it_next(it);
+			}
+		}
+	}
+
+	ChangedIt changed_since(CompID comp_id, u64 frame)
+	{
+		ChangedIt it;
+		it.entity = 0;
+		it.comp = NULL;
+		it.has_next = component_exists(comp_id);
+		it._comp_id = comp_id;
+		it._frame = frame;
+		it._archetype = 0u;
+		it._column = u32_max;
+		it._row = 0u;
+
+		if (it.has_next) changed_next(it);
+		return it;
+	}
+
+	void changed_next(ChangedIt& it)
+	{
+		SV_ECS();
+
+		const List<u32>& archetypes = ecs.component_allocator[it._comp_id].archetypes;
+
+		while (it._archetype < archetypes.size()) {
+
+			Archetype& archetype = ecs.archetypes[archetypes[it._archetype]];
+
+			if (it._column == u32_max) {
+				it._column = find_archetype_column(archetype, it._comp_id);
+				it._row = 0u;
+			}
+
+			while (it._row < archetype.count) {
+
+				u32 chunk = it._row / archetype.chunk_capacity;
+
+				// Skip the chunks without changes
+				if (archetype.versions[chunk * archetype.column_count + it._column] < it._frame) {
+					it._row = (chunk + 1u) * archetype.chunk_capacity;
+					continue;
+				}
+
+				u32 row = it._row++;
+				it.entity = *get_archetype_entities(archetype, row);
+				it.comp = get_archetype_component(archetype, it._column, row);
+				return;
+			}
+
+			++it._archetype;
+			it._column = u32_max;
+		}
+
+		it.has_next = false;
+	}
+
+	SV_AUX u64 get_entity_tag_mask(const EntityInternal& internal)
+	{
+		SV_ECS();
+
+		u64 tag_mask = internal.tag_mask;
+		if (is_prefab(internal.prefab))
+			tag_mask |= ecs.entity_internal[internal.prefab - 1u].tag_mask;
+		return tag_mask;
+	}
+
+	TagQueryIt tag_query_begin(u64 tag_mask)
+	{
+		SV_ECS();
+
+		TagQueryIt it;
+		it.entity = 0;
+		it.has_next = false;
+		it._tag_mask = tag_mask;
+		it._tag = TAG_INVALID;
+		it._index = 0u;
+		it._prefab = 0;
+		it._prefab_index = 0u;
+
+		if (tag_mask == 0u) return it;
+
+		// Iterate the smallest set, the others are tested with the tag masks
+		u32 min_count = u32_max;
+
+		foreach(tag, TAG_MAX) {
+
+			if (tag_mask & SV_BIT(tag)) {
+
+				if (!tag_exists(tag)) return it;
+
+				u32 count = u32(ecs.tags[tag].entities.size());
+				if (count < min_count) {
+					min_count = count;
+					it._tag = tag;
+				}
+			}
+		}
+
+		it.has_next = true;
+		tag_query_next(it);
+		return it;
+	}
+
+	void tag_query_next(TagQueryIt& it)
+	{
+		SV_ECS();
+
+		const TagInternal& tag = ecs.tags[it._tag];
+
+		while (1) {
+
+			// The instances inherit the tags of the prefab
+			if (it._prefab) {
+
+				const EntityInternal& prefab_internal = ecs.entity_internal[it._prefab - 1u];
+				const EntityPrefab& prefab = *prefab_internal.own_prefab;
+
+				while (it._prefab_index < prefab.entities.size()) {
+
+					Entity instance = prefab.entities[it._prefab_index++];
+					u64 mask = ecs.entity_internal[instance - 1u].tag_mask | prefab_internal.tag_mask;
+
+					if ((mask & it._tag_mask) == it._tag_mask) {
+						it.entity = instance;
+						return;
+					}
+				}
+
+				it._prefab = 0;
+			}
+
+			if (it._index >= tag.entities.size()) {
+				it.has_next = false;
+				return;
+			}
+
+			Entity entity = tag.entities[it._index++];
+			const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+			if (internal.own_prefab) {
+				it._prefab = entity;
+				it._prefab_index = 0u;
+			}
+			else if ((get_entity_tag_mask(internal) & it._tag_mask) == it._tag_mask) {
+				it.entity = entity;
+				return;
+			}
+		}
+	}
+
+	SV_AUX QueryCache& get_query_cache(const CompID* comp_ids, u32 comp_count, u64 exclude_mask, u32& index)
+	{
+		SV_ECS();
+
+		index = u32_max;
+
+		foreach(i, ecs.queries.size()) {
+
+			const QueryCache& q = ecs.queries[i];
+
+			if (q.comp_count == comp_count && q.exclude_mask == exclude_mask && memcmp(q.comp_ids, comp_ids, sizeof(CompID) * comp_count) == 0) {
+				index = i;
+				break;
+			}
+		}
+
+		if (index == u32_max) {
+
+			index = u32(ecs.queries.size());
+
+			QueryCache& q = ecs.queries.emplace_back();
+			memcpy(q.comp_ids, comp_ids, sizeof(CompID) * comp_count);
+			q.comp_count = comp_count;
+			q.exclude_mask = exclude_mask;
+			q.archetype_count = 0u;
+		}
+
+		QueryCache& q = ecs.queries[index];
+
+		u64 include_mask = 0u;
+		foreach(i, comp_count)
+			include_mask |= SV_BIT(comp_ids[i]);
+
+		// Add the new archetypes
+		while (q.archetype_count < ecs.archetypes.size()) {
+
+			const Archetype& archetype = ecs.archetypes[q.archetype_count];
+
+			if ((archetype.mask & include_mask) == include_mask && (archetype.mask & exclude_mask) == 0u) {
+
+				QueryMatch& match = q.matches.emplace_back();
+				match.archetype = q.archetype_count;
+
+				foreach(i, comp_count) {
+					match.columns[i] = u8(find_archetype_column(archetype, comp_ids[i]));
+				}
+			}
+
+			++q.archetype_count;
+		}
+
+		return q;
+	}
+
+	QueryIt query_begin(const CompID* comp_ids, u32 comp_count, u64 exclude_mask, u64 write_mask)
+	{
+		QueryIt it;
+		it.entity = 0;
+		it._write_mask = write_mask;
+		it.has_next = false;
+		it._query = u32_max;
+		it._match_index = 0u;
+		it._row = 0u;
+		it._prefab = 0;
+		it._prefab_index = 0u;
+		it._instance_index = 0u;
+
+		if (!there_is_scene() || comp_count == 0u || comp_count > QUERY_COMPONENTS_MAX)
+			return it;
+
+		foreach(i, comp_count) {
+			if (!component_exists(comp_ids[i]))
+				return it;
+		}
+
+		get_query_cache(comp_ids, comp_count, exclude_mask, it._query);
+		update_hierarchy();
+
+		it.has_next = true;
+		query_next(it);
+
+		return it;
+	}
+
+	void query_next(QueryIt& it)
+	{
+		SV_ECS();
+
+		// Next prefab instance
+		if (it._prefab) {
+
+			EntityPrefab& prefab = *ecs.entity_internal[it._prefab - 1u].own_prefab;
+
+			if (++it._instance_index < prefab.entities.size()) {
+
+				it.entity = prefab.entities[it._instance_index] | (it._prefab_index << 24);
+				return;
+			}
+			else it._prefab = 0;
+		}
+
+		const QueryCache& q = ecs.queries[it._query];
+
+		while (it._match_index < q.matches.size()) {
+
+			const QueryMatch& match = q.matches[it._match_index];
+			Archetype& archetype = ecs.archetypes[match.archetype];
+
+			while (it._row < archetype.count) {
+
+				u32 row = it._row++;
+				Entity entity = *get_archetype_entities(archetype, row);
+
+				foreach(i, q.comp_count) {
+					it.comps[i] = get_archetype_component(archetype, match.columns[i], row);
+
+					if (it._write_mask & SV_BIT(q.comp_ids[i]))
+						mark_chunk_changed(archetype, row, match.columns[i]);
+				}
+
+				const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+				// The prefab entities are iterated through their instances
+				Entity prefab = 0;
+				u32 prefab_index = 0u;
+
+				if (internal.own_prefab) {
+					prefab = entity;
+				}
+				else if (ecs.entity_misc[entity - 1u].flags & EntityFlag_PrefabChild) {
 
-		if (it.prefab) {
+					prefab = internal.parent;
+					while (ecs.entity_internal[prefab - 1u].parent != 0)
+						prefab = ecs.entity_internal[prefab - 1u].parent;
 
-			EntityPrefab& prefab = *ecs.entity_internal[it.prefab - 1].own_prefab;
-			if (it._prefab_index < prefab.entities.size()) {
+					prefab_index = internal.hierarchy_index - ecs.entity_internal[prefab - 1u].hierarchy_index;
+				}
 
-				it.entity = prefab.entities[it._prefab_index++];
-				return;
-			}
-			else {
-				it.prefab = 0;
-			}
-		}
+				if (prefab) {
 
-		++it._index;
-		
-		if (it._index >= internal.entities.size())
-			it.has_next = false;
-		else {
-			it.entity = internal.entities[it._index];
-			if (is_prefab(it.entity)) {
+					EntityPrefab* p = ecs.entity_internal[prefab - 1u].own_prefab;
+					SV_ASSERT(p);
 
-				it.prefab = it.entity;
-				it.entity = 0;
-				it._prefab_index = 0;
-				tag_it_next(it);
+					if (p && p->entities.size()) {
+
+						it._prefab = prefab;
+						it._prefab_index = prefab_index;
+						it._instance_index = 0u;
+						it.entity = p->entities.front() | (prefab_index << 24);
+						return;
+					}
+				}
+				else {
+
+					it.entity = entity;
+					return;
+				}
 			}
+
+			++it._match_index;
+			it._row = 0u;
 		}
+
+		it.has_next = false;
 	}
 
 	Tag get_tag_id(const char* name)
@@ -2761,8 +4889,10 @@ namespace sv {
 		CopyComponentFn	       copy_fn;
 		SerializeComponentFn   serialize_fn;
 		DeserializeComponentFn deserialize_fn;
+		SnapshotComponentFn    snapshot_fn;
 		Library                library;
 		const char*            struct_name;
+		u32                    flags;
 
     };
 
@@ -2779,8 +4909,10 @@ namespace sv {
 		reg.copy_fn = desc.copy_fn;
 		reg.serialize_fn = desc.serialize_fn;
 		reg.deserialize_fn = desc.deserialize_fn;
+		reg.snapshot_fn = desc.snapshot_fn;
 		reg.library = desc.library;
 		string_copy(reg.struct_name, desc.struct_name, COMPONENT_NAME_SIZE + 1u);
+		reg.flags = desc.flags;
 		
 		return true;
 	}
@@ -2845,7 +4977,7 @@ namespace sv {
 #endif
 
 	template<typename T>
-	SV_AUX bool register_component(const char* name)
+	SV_AUX bool register_component(const char* name, u32 flags = 0u)
 	{
 		ComponentRegisterDesc desc;
 		desc.name = name;
@@ -2853,6 +4985,7 @@ namespace sv {
 		desc.version = T::VERSION;
 		desc.library = 0;
 		desc.struct_name = "";
+		desc.flags = flags;
 
 		desc.create_fn = [](Component* comp, Entity entity)
 			{
@@ -2886,24 +5019,37 @@ namespace sv {
 				comp->deserialize(d, version);
 			};
 
+		desc.snapshot_fn = NULL;
+
+		if (flags & ComponentRegisterFlag_Snapshot) {
+			
+			desc.snapshot_fn = [](Component* dst, const Component* src)
+				{
+					new(dst) T(*reinterpret_cast<const T*>(src));
+				};
+		}
+
 		return register_component(desc);
 	}
 
 	void register_components()
 	{
-		register_component<SpriteComponent>("Sprite");
-		register_component<TexturedSpriteComponent>("Textured Sprite");
-		register_component<AnimatedSpriteComponent>("Animated Sprite");
-		register_component<CameraComponent>("Camera");
-		register_component<MeshComponent>("Mesh");
+		register_component<SpriteComponent>("Sprite", ComponentRegisterFlag_Snapshot);
+		register_component<TexturedSpriteComponent>("Textured Sprite", ComponentRegisterFlag_Snapshot);
+		register_component<AnimatedSpriteComponent>("Animated Sprite", ComponentRegisterFlag_Snapshot);
+		register_component<CameraComponent>("Camera", ComponentRegisterFlag_Snapshot);
+		register_component<MeshComponent>("Mesh", ComponentRegisterFlag_Snapshot);
 		register_component<TerrainComponent>("Terrain");
-		register_component<ParticleSystem>("Particle System");
-		register_component<ParticleSystemModel>("Particle System Model");
-		register_component<LightComponent>("Light");
+		register_component<ParticleSystem>("Particle System", ComponentRegisterFlag_Compact);
+		register_component<ParticleSystemModel>("Particle System Model", ComponentRegisterFlag_Compact | ComponentRegisterFlag_Snapshot);
+		register_component<LightComponent>("Light", ComponentRegisterFlag_Snapshot);
 
+		// The physics and audio components own external resources, the snapshots use the serialization
 		ComponentRegisterDesc desc;
 		desc.library = 0;
 		desc.struct_name = "";
+		desc.flags = 0u;
+		desc.snapshot_fn = NULL;
 		
 		desc.name = "Body";
 		desc.size = sizeof(BodyComponent);
@@ -3069,14 +5215,28 @@ namespace sv {
 
 		u32 count = 0u;
 
-		foreach(i, alloc.pool_count) {
+		if (is_archetype_component(comp_id)) {
 
-			ComponentPool* pool = alloc.pools + i;
-			count += pool->count - pool->free_count;
+			for (u32 index : alloc.archetypes)
+				count += ecs.archetypes[index].count;
+		}
+		else {
+
+			foreach(i, alloc.pool_count) {
+
+				ComponentPool* pool = alloc.pools + i;
+				count += pool->count - pool->free_count;
+			}
 		}
 
 		return count;
 	}
+
+	u32 get_component_flags(CompID comp_id)
+	{
+		ComponentRegister& reg = scene_state->component_register[comp_id];
+		return reg.flags;
+	}
 	
     bool component_exists(CompID ID)
 	{
@@ -3108,81 +5268,275 @@ namespace sv {
 		XMMATRIX m = compute_world_matrix(entity, parent);
 	
 		XMStoreFloat4x4(&t.world_matrix, m);
+
+		// The mirrors depend on the instance world matrix
+		if (internal.mirrors) internal.mirrors->dirty = true;
     }
 
+	constexpr u32 WORLD_MATRIX_GRAIN = 256u;
+	constexpr u32 WORLD_MATRIX_BATCH = 64u;
+
+	void update_world_matrices()
+	{
+		SV_ECS();
+
+		update_hierarchy();
+
+		u32 count = u32(ecs.entity_hierarchy.size());
+
+		ecs.transform_depth.resize(count);
+		ecs.transform_level_offset.reset();
+		ecs.transform_entities.reset();
+
+		// The parents are always before the children in the hierarchy
+		foreach(i, count) {
+
+			Entity entity = ecs.entity_hierarchy[i];
+			const EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+			u32 depth = 0u;
+			if (internal.parent != 0)
+				depth = ecs.transform_depth[ecs.entity_internal[internal.parent - 1u].hierarchy_index] + 1u;
+
+			ecs.transform_depth[i] = depth;
+
+			if (ecs.entity_transform[entity - 1u].dirty) {
+
+				while (ecs.transform_level_offset.size() <= depth + 1u)
+					ecs.transform_level_offset.push_back(0u);
+
+				++ecs.transform_level_offset[depth + 1u];
+				ecs.transform_entities.push_back(entity);
+			}
+		}
+
+		u32 dirty_count = u32(ecs.transform_entities.size());
+		if (dirty_count == 0u) return;
+
+		u32 level_count = u32(ecs.transform_level_offset.size()) - 1u;
+
+		for (u32 i = 1u; i <= level_count; ++i)
+			ecs.transform_level_offset[i] += ecs.transform_level_offset[i - 1u];
+
+		// Sort the entities by level
+		ecs.transform_sorted.resize(dirty_count);
+
+		foreach(i, dirty_count) {
+
+			Entity entity = ecs.transform_entities[i];
+			u32 depth = ecs.transform_depth[ecs.entity_internal[entity - 1u].hierarchy_index];
+
+			ecs.transform_sorted[ecs.transform_level_offset[depth]++] = entity;
+		}
+
+		// The levels are updated in order, the entities of the same level only read the matrices of the previous levels
+		u32 begin = 0u;
+
+		foreach(level, level_count) {
+
+			u32 end = ecs.transform_level_offset[level];
+
+			task_parallel_for(begin, end, WORLD_MATRIX_GRAIN, [&ecs](u32 range_begin, u32 range_end) {
+
+				// The local transforms are copied to separated arrays to build the matrices with SIMD
+				f32 position[3][WORLD_MATRIX_BATCH];
+				f32 rotation[4][WORLD_MATRIX_BATCH];
+				f32 scale[3][WORLD_MATRIX_BATCH];
+				XMFLOAT4X4 local_matrices[WORLD_MATRIX_BATCH];
+
+				TransformStream stream = {
+					{ position[0], position[1], position[2] },
+					{ rotation[0], rotation[1], rotation[2], rotation[3] },
+					{ scale[0], scale[1], scale[2] }
+				};
+
+				for (u32 batch = range_begin; batch < range_end; batch += WORLD_MATRIX_BATCH) {
+
+					u32 count = SV_MIN(range_end - batch, WORLD_MATRIX_BATCH);
+
+					foreach(i, count) {
+
+						const EntityTransform& t = ecs.entity_transform[ecs.transform_sorted[batch + i] - 1u];
+
+						position[0][i] = t.position.x;
+						position[1][i] = t.position.y;
+						position[2][i] = t.position.z;
+						rotation[0][i] = t.rotation.x;
+						rotation[1][i] = t.rotation.y;
+						rotation[2][i] = t.rotation.z;
+						rotation[3][i] = t.rotation.w;
+						scale[0][i] = t.scale.x;
+						scale[1][i] = t.scale.y;
+						scale[2][i] = t.scale.z;
+					}
+
+					mat_compose_stream(stream, 0u, count, local_matrices);
+
+					foreach(i, count) {
+
+						Entity entity = ecs.transform_sorted[batch + i];
+						EntityTransform& t = ecs.entity_transform[entity - 1u];
+						EntityInternal& internal = ecs.entity_internal[entity - 1u];
+						Entity parent = internal.parent;
+
+						if (parent != 0) {
+							XMMATRIX m = XMLoadFloat4x4(local_matrices + i) * XMLoadFloat4x4(&ecs.entity_transform[parent - 1u].world_matrix);
+							XMStoreFloat4x4(&t.world_matrix, m);
+						}
+						else t.world_matrix = local_matrices[i];
+						
+						t.dirty = false;
+
+						if (internal.mirrors) internal.mirrors->dirty = true;
+					}
+				}
+			});
+
+			begin = end;
+		}
+	}
+
     SV_AUX void notify_transform(EntityTransform& t, Entity entity)
     {
 		SV_ECS();
+
+		// The prefab childs are shared by all the mirrors
+		if (ecs.entity_misc[entity - 1u].flags & EntityFlag_PrefabChild || ecs.entity_internal[entity - 1u].own_prefab)
+			++ecs.mirror_version;
+
+		mark_entity_changed(entity);
+		mark_spatial_dirty(entity);
 	
 		if (!t.dirty) {
 
 			t.dirty = true;
 			t.dirty_physics = true;
 
-			EntityInternal& internal = ecs.entity_internal[entity - 1];
-
-			if (internal.child_count == 0) return;
-
-			for (u32 i = 0; i < internal.child_count; ++i) {
-				Entity e = ecs.entity_hierarchy[internal.hierarchy_index + 1 + i];
+			for (Entity e = next_subtree_entity(entity, entity); e != 0; e = next_subtree_entity(entity, e)) {
+				
 				EntityTransform& et = ecs.entity_transform[e - 1u];
 				et.dirty = true;
 				et.dirty_physics = true;
+
+				mark_entity_changed(e);
+				mark_spatial_dirty(e);
 			}
 		}
     }
 
-    void set_entity_transform(Entity entity, const Transform& transform)
-    {
+	SV_AUX EntityMirrorOverride* find_mirror_override(EntityMirrorBlock* block, Entity child)
+	{
+		if (block) {
+
+			for (EntityMirrorOverride& o : block->overrides) {
+				if (o.child == child) return &o;
+			}
+		}
+		return NULL;
+	}
+
+	// The mirrors without override use the transform of the prefab child
+	SV_AUX const EntityLocalTransform& get_local_transform(Entity entity)
+	{
+		SV_ECS();
+
+		if (is_mirror(entity)) {
+
+			const EntityInternal& internal = ecs.entity_internal[get_origin_entity(entity) - 1u];
+			const EntityMirrorOverride* o = find_mirror_override(internal.mirrors, get_reflected_entity(entity));
+			if (o) return o->transform;
+		}
+
 		entity = get_reflected_entity(entity);
+		return ecs.entity_transform[entity - 1u];
+	}
 
+	// Modifying a mirror creates an override in the instance, the prefab child isn't modified
+	SV_AUX EntityLocalTransform& write_local_transform(Entity entity)
+	{
 		SV_ECS();
+
+		if (is_mirror(entity)) {
+
+			Entity child = get_reflected_entity(entity);
+			EntityMirrorBlock& block = get_mirror_block(get_origin_entity(entity));
+
+			mark_entity_changed(get_origin_entity(entity));
+
+			EntityMirrorOverride* o = find_mirror_override(&block, child);
+			if (o) return o->transform;
+
+			EntityMirrorOverride mirror_override;
+			mirror_override.child = child;
+			mirror_override.transform = ecs.entity_transform[child - 1u];
+			block.overrides.push_back(mirror_override);
+
+			return block.overrides.back().transform;
+		}
+
+		entity = get_reflected_entity(entity);
 		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		notify_transform(t, entity);
+
+		return t;
+	}
+
+	void reset_mirror_transform(Entity mirror)
+	{
+		SV_ECS();
+
+		if (!is_mirror(mirror)) return;
+
+		EntityInternal& internal = ecs.entity_internal[get_origin_entity(mirror) - 1u];
+		EntityMirrorBlock* block = internal.mirrors;
+
+		if (block) {
+
+			Entity child = get_reflected_entity(mirror);
+			
+			foreach(i, block->overrides.size()) {
+
+				if (block->overrides[i].child == child) {
+					block->overrides.erase(i);
+					break;
+				}
+			}
+
+			if (block->overrides.empty())
+				free_mirror_block(internal);
+		}
+	}
+
+    void set_entity_transform(Entity entity, const Transform& transform)
+    {
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.position = transform.position;
 		t.rotation = transform.rotation;
 		t.scale = transform.scale;
-		notify_transform(t, entity);
     }
     
     void set_entity_position(Entity entity, const v3_f32& position)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.position = position;
-		notify_transform(t, entity);
     }
     
     void set_entity_rotation(Entity entity, const v4_f32& rotation)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.rotation = rotation;
-		notify_transform(t, entity);
     }
     
     void set_entity_scale(Entity entity, const v3_f32& scale)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.scale = scale;
-		notify_transform(t, entity);
     }
     
     void set_entity_matrix(Entity entity, const XMMATRIX& matrix)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 	
-		notify_transform(t, entity);
-
 		XMVECTOR scale;
 		XMVECTOR rotation;
 		XMVECTOR position;
@@ -3196,46 +5550,30 @@ namespace sv {
 
     void set_entity_position2D(Entity entity, const v2_f32& position)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.position.x = position.x;
 		t.position.y = position.y;
-		notify_transform(t, entity);
     }
 
 	void set_entity_scale2D(Entity entity, const v2_f32& scale)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		t.scale.x = scale.x;
 		t.scale.y = scale.y;
-		notify_transform(t, entity);
     }
 
 	void set_entity_euler_rotation(Entity entity, v3_f32 euler_angles)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		t.rotation = XMQuaternionRotationRollPitchYaw(euler_angles.x, euler_angles.y, euler_angles.z);
-		notify_transform(t, entity);
 	}
 	
 	void set_entity_euler_rotationX(Entity entity, f32 rotation)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		EntityLocalTransform& t = write_local_transform(entity);
 		
 		//TODO t.rotation = XMQuaternionRotationRollPitchYaw(euler_angles.x, euler_angles.y, euler_angles.z);
-		notify_transform(t, entity);
 	}
 	
 	void set_entity_euler_rotationY(Entity entity, f32 rotation)
@@ -3250,76 +5588,49 @@ namespace sv {
     
     Transform* get_entity_transform_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return reinterpret_cast<Transform*>(&t.position);
     }
     
     v3_f32* get_entity_position_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return &t.position;
     }
     
     v4_f32* get_entity_rotation_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return &t.rotation;
     }
     
     v3_f32* get_entity_scale_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return &t.scale;
     }
     
     v2_f32* get_entity_position2D_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return reinterpret_cast<v2_f32*>(&t.position);
     }
     
     v2_f32* get_entity_scale2D_ptr(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		notify_transform(t, entity);
+		EntityLocalTransform& t = write_local_transform(entity);
 
 		return reinterpret_cast<v2_f32*>(&t.scale);
     }
     
     Transform get_entity_transform(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		Transform trans;
 		trans.position = t.position;
 		trans.rotation = t.rotation;
@@ -3329,66 +5640,48 @@ namespace sv {
     
     v3_f32 get_entity_position(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		return t.position;
     }
     
     v4_f32 get_entity_rotation(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		return t.rotation;
     }
     
     v3_f32 get_entity_scale(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		return t.scale;
     }
     
     v2_f32 get_entity_position2D(Entity entity)
     {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		return vec3_to_vec2(t.position);
     }
-    
-    v2_f32 get_entity_scale2D(Entity entity)
-    {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+    
+    v2_f32 get_entity_scale2D(Entity entity)
+    {
+		const EntityLocalTransform& t = get_local_transform(entity);
 		return vec3_to_vec2(t.scale);
     }
 
-    XMMATRIX get_entity_matrix(Entity entity)
-    {
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
-		
+	SV_AUX XMMATRIX local_transform_matrix(const EntityLocalTransform& t)
+	{
 		return XMMatrixScalingFromVector(vec3_to_dx(t.scale)) * XMMatrixRotationQuaternion(vec4_to_dx(t.rotation))
 			* XMMatrixTranslation(t.position.x, t.position.y, t.position.z);
+	}
+
+    XMMATRIX get_entity_matrix(Entity entity)
+    {
+		return local_transform_matrix(get_local_transform(entity));
     }
 
 	v3_f32 get_entity_euler_rotation(Entity entity)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		
 		v3_f32 euler;
 
@@ -3427,10 +5720,7 @@ namespace sv {
 	
 	f32 get_entity_euler_rotationX(Entity entity)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		
 		f32 euler;
 		v4_f32 q = t.rotation;
@@ -3448,10 +5738,7 @@ namespace sv {
 	
 	f32 get_entity_euler_rotationY(Entity entity)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		
 		f32 euler;
 		v4_f32 q = t.rotation;
@@ -3471,10 +5758,7 @@ namespace sv {
 	
 	f32 get_entity_euler_rotationZ(Entity entity)
 	{
-		entity = get_reflected_entity(entity);
-		
-		SV_ECS();
-		EntityTransform& t = ecs.entity_transform[entity - 1u];
+		const EntityLocalTransform& t = get_local_transform(entity);
 		
 		f32 euler;
 		v4_f32 q = t.rotation;
@@ -3490,6 +5774,44 @@ namespace sv {
 		return euler;
 	}
 
+	SV_AUX XMFLOAT4X4 get_entity_world_matrix_internal(Entity entity);
+
+	// Without overrides in the branch the world matrix of the prefab child is moved to the instance,
+	// otherwise the local matrices are multiplied until the instance
+	SV_AUX XMMATRIX compute_mirror_world_matrix(EntityMirrorBlock& block, Entity child, Entity prefab, const XMFLOAT4X4& instance_matrix)
+	{
+		SV_ECS();
+
+		bool overridden = false;
+
+		if (block.overrides.size()) {
+
+			for (Entity e = child; e != prefab; e = ecs.entity_internal[e - 1u].parent) {
+
+				if (find_mirror_override(&block, e)) {
+					overridden = true;
+					break;
+				}
+			}
+		}
+
+		if (!overridden) {
+
+			XMFLOAT4X4 child_matrix = get_entity_world_matrix_internal(child);
+			return XMLoadFloat4x4(&child_matrix) * XMLoadFloat4x4(&block.relative_matrix);
+		}
+
+		const EntityMirrorOverride* o = find_mirror_override(&block, child);
+		XMMATRIX m = local_transform_matrix(o ? o->transform : ecs.entity_transform[child - 1u]);
+
+		Entity parent = ecs.entity_internal[child - 1u].parent;
+
+		if (parent == prefab)
+			return m * XMLoadFloat4x4(&instance_matrix);
+
+		return m * compute_mirror_world_matrix(block, parent, prefab, instance_matrix);
+	}
+
 	SV_AUX XMFLOAT4X4 get_entity_world_matrix_internal(Entity entity)
 	{
 		SV_ECS();
@@ -3497,31 +5819,44 @@ namespace sv {
 		
 		if (is_mirror(entity)) {
 
-			Entity child = get_reflected_entity(entity);
-			Entity parent = get_entity_parent(child);
+			Entity instance = get_origin_entity(entity);
 
-			if (is_prefab(parent)) parent = get_origin_entity(entity);
-			else {
-			
-				const EntityInternal& parent_internal = ecs.entity_internal[parent - 1];
+			// The instance is updated first, it invalidates the mirrors if the world matrix changes
+			XMFLOAT4X4 instance_matrix = get_entity_world_matrix_internal(instance);
 
-				Entity prefab = 0;
+			update_hierarchy();
 
-				while (parent != 0) {
+			EntityMirrorBlock* block = ecs.entity_internal[instance - 1u].mirrors;
+			Entity prefab = ecs.entity_internal[instance - 1u].prefab;
+			Entity child = get_reflected_entity(entity);
 
-					prefab = parent;
-					const EntityInternal& internal = ecs.entity_internal[parent - 1];
-					parent = internal.parent;
-				}
+			// The block is allocated by the first override, the instances without overrides compute the matrix without caching it
+			if (block == NULL) {
+
+				XMFLOAT4X4 prefab_matrix = get_entity_world_matrix_internal(prefab);
+				XMFLOAT4X4 child_matrix = get_entity_world_matrix_internal(child);
+				
+				XMMATRIX m = XMLoadFloat4x4(&child_matrix) * XMMatrixInverse(NULL, XMLoadFloat4x4(&prefab_matrix)) * XMLoadFloat4x4(&instance_matrix);
+				XMStoreFloat4x4(&world_matrix, m);
+				
+				return world_matrix;
+			}
 
-				const EntityInternal& prefab_internal = ecs.entity_internal[prefab - 1];
+			if (block->version != ecs.mirror_version) {
+				block->version = ecs.mirror_version;
+				block->dirty = true;
+			}
+
+			if (block->dirty) {
 
-				u32 index = parent_internal.hierarchy_index - prefab_internal.hierarchy_index;
+				block->dirty = false;
 
-				parent = get_origin_entity(entity) | (index << 24);
+				XMFLOAT4X4 prefab_matrix = get_entity_world_matrix_internal(prefab);
+				XMMATRIX m = XMMatrixInverse(NULL, XMLoadFloat4x4(&prefab_matrix)) * XMLoadFloat4x4(&instance_matrix);
+				XMStoreFloat4x4(&block->relative_matrix, m);
 			}
-			
-			XMMATRIX m = compute_world_matrix(child, parent);
+
+			XMMATRIX m = compute_mirror_world_matrix(*block, child, prefab, instance_matrix);
 			XMStoreFloat4x4(&world_matrix, m);
 		}
 		else {
@@ -3583,6 +5918,435 @@ namespace sv {
 		return XMLoadFloat4x4(&world_matrix);
     }
 
+	//////////////////////////////////////////// SPATIAL INDEX ////////////////////////////////////////////////////////
+
+	SV_AUX i32 spatial_coord(f32 v)
+	{
+		return i32(floorf(v / SPATIAL_CELL_SIZE));
+	}
+
+	SV_AUX u64 spatial_cell_key(i32 x, i32 y, i32 z)
+	{
+		u64 hash = (u64(u32(x)) * 73856093ULL) ^ (u64(u32(y)) * 19349663ULL) ^ (u64(u32(z)) * 83492791ULL);
+		return hash | SV_BIT(63);
+	}
+
+	SV_AUX void spatial_cell_coords(const v3_f32& p, i32* coords)
+	{
+		SV_ECS();
+		
+		coords[0] = spatial_coord(p.x);
+		coords[1] = spatial_coord(p.y);
+		coords[2] = ecs.spatial_3D ? spatial_coord(p.z) : 0;
+	}
+
+	SV_AUX void spatial_insert(Entity entity, const v3_f32& center, f32 radius)
+	{
+		SV_ECS();
+
+		SpatialEntry entry;
+		entry.entity = entity;
+		entry.center = center;
+		entry.radius = radius;
+
+		u64 key;
+		List<SpatialEntry>* entries;
+
+		if (radius > SPATIAL_CELL_SIZE * 0.5f) {
+
+			key = SPATIAL_CELL_LARGE;
+			entries = &ecs.spatial_large;
+		}
+		else {
+
+			i32 c[3];
+			spatial_cell_coords(center, c);
+			key = spatial_cell_key(c[0], c[1], c[2]);
+
+			bool first_cell = ecs.spatial_cells.empty();
+			SpatialCell& cell = ecs.spatial_cells[key];
+
+			foreach(i, 3u) {
+
+				f32 min = center[i] - radius;
+				f32 max = center[i] + radius;
+
+				if (cell.entries.empty()) {
+					cell.min[i] = min;
+					cell.max[i] = max;
+				}
+				else {
+					cell.min[i] = SV_MIN(cell.min[i], min);
+					cell.max[i] = SV_MAX(cell.max[i], max);
+				}
+
+				if (first_cell) {
+					ecs.spatial_min[i] = min;
+					ecs.spatial_max[i] = max;
+				}
+				else {
+					ecs.spatial_min[i] = SV_MIN(ecs.spatial_min[i], min);
+					ecs.spatial_max[i] = SV_MAX(ecs.spatial_max[i], max);
+				}
+			}
+
+			entries = &cell.entries;
+		}
+
+		EntityInternal& internal = ecs.entity_internal[entity - 1u];
+		internal.spatial_cell = key;
+		internal.spatial_index = u32(entries->size());
+		entries->push_back(entry);
+	}
+
+	SV_INTERNAL void update_spatial_index()
+	{
+		SV_ECS();
+
+		// The cells of the 2D scenes ignore the z axis
+		bool in_3D = scene.data.physics.in_3D;
+
+		if (in_3D != ecs.spatial_3D) {
+
+			ecs.spatial_3D = in_3D;
+			
+			foreach(i, ecs.entity_size) {
+
+				EntityInternal& internal = ecs.entity_internal[i];
+
+				if (internal.spatial_cell) {
+					spatial_remove(i + 1u);
+					mark_spatial_dirty(i + 1u);
+				}
+			}
+		}
+
+		foreach(i, ecs.spatial_dirty.size()) {
+
+			Entity entity = ecs.spatial_dirty[i];
+			EntityInternal& internal = ecs.entity_internal[entity - 1u];
+
+			// Destroyed or repeated
+			if (!internal.spatial_dirty) continue;
+			internal.spatial_dirty = false;
+
+			spatial_remove(entity);
+
+			// The prefabs are templates, the instances are indexed
+			if (internal.own_prefab || (ecs.entity_misc[entity - 1u].flags & EntityFlag_PrefabChild))
+				continue;
+
+			// Bounding sphere of the unit cube
+			XMFLOAT4X4 m = get_entity_world_matrix_internal(entity);
+			
+			v3_f32 center = *(v3_f32*)&m._41;
+			f32 radius = 0.5f * sqrtf(vec3_dot(*(v3_f32*)&m._11, *(v3_f32*)&m._11) + vec3_dot(*(v3_f32*)&m._21, *(v3_f32*)&m._21) + vec3_dot(*(v3_f32*)&m._31, *(v3_f32*)&m._31));
+
+			spatial_insert(entity, center, radius);
+		}
+
+		ecs.spatial_dirty.reset();
+	}
+
+	SV_AUX bool intersect_sphere_vs_aabb(const v3_f32& center, f32 radius, const v3_f32& min, const v3_f32& max)
+	{
+		f32 distance = 0.f;
+
+		foreach(i, 3u) {
+
+			f32 v = center[i];
+			
+			if (v < min[i]) distance += (min[i] - v) * (min[i] - v);
+			else if (v > max[i]) distance += (v - max[i]) * (v - max[i]);
+		}
+
+		return distance <= radius * radius;
+	}
+
+	// Returns the distance to the first intersection, negative if there is no intersection
+	SV_AUX f32 intersect_ray_vs_sphere(const Ray& ray, const v3_f32& center, f32 radius)
+	{
+		v3_f32 to = ray.origin;
+		to -= center;
+		
+		f32 a = vec3_dot(ray.direction, ray.direction);
+		f32 b = vec3_dot(to, ray.direction);
+		f32 c = vec3_dot(to, to) - radius * radius;
+
+		// Inside
+		if (c <= 0.f) return 0.f;
+		if (b > 0.f || a == 0.f) return -1.f;
+
+		f32 disc = b * b - a * c;
+		if (disc < 0.f) return -1.f;
+
+		// Distance in units of the ray direction
+		return (-b - sqrtf(disc)) / a;
+	}
+
+	// The segment of the ray inside the box is returned in units of the ray direction
+	SV_AUX bool intersect_ray_vs_aabb(const Ray& ray, const v3_f32& min, const v3_f32& max, f32* t_min = NULL, f32* t_max = NULL)
+	{
+		f32 t0 = 0.f;
+		f32 t1 = f32_max;
+
+		foreach(i, 3u) {
+
+			f32 o = ray.origin[i];
+			f32 d = ray.direction[i];
+
+			if (abs(d) < 0.0000001f) {
+				if (o < min[i] || o > max[i]) return false;
+			}
+			else {
+
+				f32 inv = 1.f / d;
+				f32 t_near = (min[i] - o) * inv;
+				f32 t_far = (max[i] - o) * inv;
+
+				if (t_near > t_far) std::swap(t_near, t_far);
+
+				t0 = SV_MAX(t0, t_near);
+				t1 = SV_MIN(t1, t_far);
+
+				if (t0 > t1) return false;
+			}
+		}
+
+		if (t_min) *t_min = t0;
+		if (t_max) *t_max = t1;
+		return true;
+	}
+
+	// Calls the function with the entries that can intersect with the box (it isn't tested)
+	template<typename F>
+	SV_AUX void spatial_visit(const v3_f32& min, const v3_f32& max, F fn)
+	{
+		SV_ECS();
+
+		for (const SpatialEntry& entry : ecs.spatial_large)
+			fn(entry);
+
+		// The entries can overflow its cell half cell
+		f32 loose = SPATIAL_CELL_SIZE * 0.5f;
+		
+		v3_f32 loose_min = min;
+		v3_f32 loose_max = max;
+		loose_min -= loose;
+		loose_max += loose;
+		
+		i32 c0[3];
+		i32 c1[3];
+		spatial_cell_coords(loose_min, c0);
+		spatial_cell_coords(loose_max, c1);
+
+		f64 range = f64(c1[0] - c0[0] + 1) * f64(c1[1] - c0[1] + 1) * f64(c1[2] - c0[2] + 1);
+
+		// Big regions iterate the cells instead of the coordinates
+		if (range > f64(ecs.spatial_cells.size())) {
+
+			for (SpatialCell& cell : ecs.spatial_cells) {
+
+				if (cell.max.x < min.x || cell.min.x > max.x || cell.max.y < min.y || cell.min.y > max.y || cell.max.z < min.z || cell.min.z > max.z)
+					continue;
+
+				for (const SpatialEntry& entry : cell.entries)
+					fn(entry);
+			}
+		}
+		else {
+
+			for (i32 z = c0[2]; z <= c1[2]; ++z) {
+				for (i32 y = c0[1]; y <= c1[1]; ++y) {
+					for (i32 x = c0[0]; x <= c1[0]; ++x) {
+
+						SpatialCell* cell = ecs.spatial_cells.find(spatial_cell_key(x, y, z));
+						if (cell == NULL) continue;
+
+						for (const SpatialEntry& entry : cell->entries) {
+
+							// Different coordinates can share the cell
+							i32 c[3];
+							spatial_cell_coords(entry.center, c);
+							
+							if (c[0] == x && c[1] == y && c[2] == z)
+								fn(entry);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void scene_query_aabb(const v3_f32& min, const v3_f32& max, List<Entity>& entities)
+	{
+		spatial_visit(min, max, [&](const SpatialEntry& entry) {
+			
+			if (intersect_sphere_vs_aabb(entry.center, entry.radius, min, max))
+				entities.push_back(entry.entity);
+		});
+	}
+
+	void scene_query_sphere(const v3_f32& center, f32 radius, List<Entity>& entities)
+	{
+		v3_f32 min = center;
+		v3_f32 max = center;
+		min -= radius;
+		max += radius;
+		
+		spatial_visit(min, max, [&](const SpatialEntry& entry) {
+
+			f32 r = radius + entry.radius;
+			v3_f32 to = entry.center;
+			to -= center;
+			
+			if (vec3_dot(to, to) <= r * r)
+				entities.push_back(entry.entity);
+		});
+	}
+
+	// Calls the function with the entries that intersect with the ray and the distance
+	template<typename F>
+	SV_AUX void spatial_visit_ray(const Ray& ray, F fn)
+	{
+		SV_ECS();
+
+		auto test = [&](const SpatialEntry& entry) {
+
+			f32 distance = intersect_ray_vs_sphere(ray, entry.center, entry.radius);
+			if (distance >= 0.f) fn(entry, distance);
+		};
+
+		for (const SpatialEntry& entry : ecs.spatial_large)
+			test(entry);
+
+		f32 t0, t1;
+		
+		if (ecs.spatial_cells.empty() || !intersect_ray_vs_aabb(ray, ecs.spatial_min, ecs.spatial_max, &t0, &t1))
+			return;
+
+		// 3D-DDA over a grid of half cells. The entries can overflow its cell half cell, so each half cell
+		// has two candidate cells per axis. The 2D scenes ignore the z axis
+		u32 axis_count = ecs.spatial_3D ? 3u : 2u;
+		f32 half = SPATIAL_CELL_SIZE * 0.5f;
+
+		i32 h[3] = {};
+		i32 step[3] = {};
+		f32 t_next[3] = { f32_max, f32_max, f32_max };
+		f32 t_delta[3] = { f32_max, f32_max, f32_max };
+		u64 step_count = 0u;
+
+		foreach(i, axis_count) {
+
+			f32 o = ray.origin[i];
+			f32 d = ray.direction[i];
+			
+			h[i] = i32(floorf((o + d * t0) / half));
+			i32 h_end = i32(floorf((o + d * t1) / half));
+
+			if (d > 0.f) {
+				step[i] = 1;
+				t_next[i] = (f32(h[i] + 1) * half - o) / d;
+				t_delta[i] = half / d;
+			}
+			else if (d < 0.f) {
+				step[i] = -1;
+				t_next[i] = (f32(h[i]) * half - o) / d;
+				t_delta[i] = -half / d;
+			}
+			else h_end = h[i];
+
+			step_count += u64(abs(h_end - h[i]));
+		}
+
+		// Long rays iterate the cells instead of the grid
+		if (f64(step_count + 1u) > f64(ecs.spatial_cells.size())) {
+
+			for (SpatialCell& cell : ecs.spatial_cells) {
+
+				if (!intersect_ray_vs_aabb(ray, cell.min, cell.max))
+					continue;
+
+				for (const SpatialEntry& entry : cell.entries)
+					test(entry);
+			}
+			return;
+		}
+
+		i32 last[3];
+
+		for (u64 s = 0u; s <= step_count; ++s) {
+
+			// First candidate cell of each axis
+			i32 c0[3] = {};
+			i32 c1[3] = {};
+			
+			foreach(i, axis_count) {
+				c0[i] = i32(floorf(f32(h[i] - 1) * 0.5f));
+				c1[i] = c0[i] + 1;
+			}
+
+			for (i32 z = c0[2]; z <= c1[2]; ++z) {
+				for (i32 y = c0[1]; y <= c1[1]; ++y) {
+					for (i32 x = c0[0]; x <= c1[0]; ++x) {
+
+						// The cells are candidates in consecutive steps, are visited only in the first one
+						if (s && x >= last[0] && x <= last[0] + 1 && y >= last[1] && y <= last[1] + 1 && z >= last[2] && z <= last[2] + i32(axis_count == 3u))
+							continue;
+
+						SpatialCell* cell = ecs.spatial_cells.find(spatial_cell_key(x, y, z));
+						if (cell == NULL || !intersect_ray_vs_aabb(ray, cell->min, cell->max)) continue;
+
+						for (const SpatialEntry& entry : cell->entries) {
+
+							// Different coordinates can share the cell
+							i32 c[3];
+							spatial_cell_coords(entry.center, c);
+							
+							if (c[0] == x && c[1] == y && c[2] == z)
+								test(entry);
+						}
+					}
+				}
+			}
+
+			foreach(i, 3u) last[i] = c0[i];
+
+			// Next half cell
+			u32 axis = 0u;
+			foreach(i, axis_count) {
+				if (t_next[i] < t_next[axis]) axis = i;
+			}
+			
+			h[axis] += step[axis];
+			t_next[axis] += t_delta[axis];
+		}
+	}
+
+	void scene_query_ray(const Ray& ray, List<Entity>& entities)
+	{
+		spatial_visit_ray(ray, [&](const SpatialEntry& entry, f32 distance) {
+			entities.push_back(entry.entity);
+		});
+	}
+
+	Entity scene_raycast(const Ray& ray, f32* distance)
+	{
+		Entity result = 0;
+		f32 min_distance = f32_max;
+		
+		spatial_visit_ray(ray, [&](const SpatialEntry& entry, f32 d) {
+
+			if (d < min_distance) {
+				min_distance = d;
+				result = entry.entity;
+			}
+		});
+
+		if (distance) *distance = min_distance;
+		return result;
+	}
+
 	//////////////////////////////////////////// COMPONENTS ////////////////////////////////////////////////////////
 
     bool SpriteSheet::add_sprite(u32* _id, const char* name, const v4_f32& texcoord)
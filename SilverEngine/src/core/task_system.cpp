@@ -0,0 +1,602 @@
+#include "core/task_system.h"
+
+namespace sv {
+
+	constexpr u32 TASK_THREAD_MAX = 32u;
+	constexpr u32 TASK_QUEUE_SIZE = 4096u; // Must be power of two
+	constexpr u32 TASK_QUEUE_MASK = TASK_QUEUE_SIZE - 1u;
+	constexpr u32 TASK_SPIN_COUNT = 50u;
+	constexpr u32 TASK_FOREIGN_POOL_SIZE = 256u; // Must be power of two
+
+	struct Task {
+		TaskFunction      function;
+		ThreadContext*    context;
+		std::atomic<bool> used;
+	};
+
+	// Chase-Lev work stealing deque.
+	// Only the owner thread pushes and pops from the bottom, the other threads steal from the top
+	struct TaskQueue {
+		std::atomic<i64>   top;
+		std::atomic<i64>   bottom;
+		std::atomic<Task*> tasks[TASK_QUEUE_SIZE];
+	};
+
+	struct TaskThread {
+
+		TaskQueue queue;
+
+		// Ring of tasks owned by this thread, only the owner can allocate them
+		Task pool[TASK_QUEUE_SIZE];
+		u32  pool_index;
+
+		Thread thread;
+		u32    index;
+		u32    seed;
+
+	};
+
+	struct TaskSystemState {
+
+		// The index 0 is reserved for the main thread
+		TaskThread* threads;
+		u32         thread_count;
+		u32         thread_capacity;
+
+		std::atomic<bool> running;
+		std::atomic<u32>  sleeping_count;
+		Semaphore         semaphore;
+
+		Mutex       blocking_mutex;
+		List<Task*> blocking_tasks;
+		u32         blocking_begin;
+
+		// Tasks submitted from the threads that aren't created by the task system, they go to the blocking list.
+		// Protected by the blocking mutex
+		Task foreign_pool[TASK_FOREIGN_POOL_SIZE];
+		u32  foreign_pool_index;
+
+	};
+
+	static TaskSystemState* task_system = NULL;
+	// u32_max in the threads that aren't created by the task system
+	static thread_local u32 current_thread_index = u32_max;
+
+	class ThreadPool {
+	public:
+
+		SV_INLINE static void add_tasks(ThreadContext& context, u32 count)
+		{
+			context.taskCount.fetch_add(count);
+		}
+
+		SV_INLINE static void finish_task(ThreadContext& context)
+		{
+			context.executedTasks.fetch_add(1u);
+		}
+
+		SV_INLINE static bool is_running(const ThreadContext& context)
+		{
+			return context.executedTasks.load() < context.taskCount.load();
+		}
+
+	};
+
+	SV_AUX bool queue_push(TaskQueue& queue, Task* task)
+	{
+		i64 bottom = queue.bottom.load(std::memory_order_relaxed);
+		i64 top = queue.top.load(std::memory_order_acquire);
+
+		if (bottom - top >= i64(TASK_QUEUE_SIZE))
+			return false;
+
+		queue.tasks[bottom & TASK_QUEUE_MASK].store(task, std::memory_order_release);
+		queue.bottom.store(bottom + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	SV_AUX Task* queue_pop(TaskQueue& queue)
+	{
+		i64 bottom = queue.bottom.load(std::memory_order_relaxed) - 1;
+		queue.bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		i64 top = queue.top.load(std::memory_order_relaxed);
+
+		if (top <= bottom) {
+
+			Task* task = queue.tasks[bottom & TASK_QUEUE_MASK].load(std::memory_order_acquire);
+
+			if (top == bottom) {
+
+				// Last task, compete against the thieves
+				if (!queue.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					task = NULL;
+
+				queue.bottom.store(bottom + 1, std::memory_order_relaxed);
+			}
+
+			return task;
+		}
+
+		queue.bottom.store(bottom + 1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	SV_AUX Task* queue_steal(TaskQueue& queue)
+	{
+		i64 top = queue.top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		i64 bottom = queue.bottom.load(std::memory_order_acquire);
+
+		if (top < bottom) {
+
+			Task* task = queue.tasks[top & TASK_QUEUE_MASK].load(std::memory_order_acquire);
+
+			if (!queue.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return NULL;
+
+			return task;
+		}
+
+		return NULL;
+	}
+
+	SV_AUX Task* pop_blocking_task()
+	{
+		Task* task = NULL;
+
+		SV_LOCK_GUARD(task_system->blocking_mutex, lock);
+
+		List<Task*>& tasks = task_system->blocking_tasks;
+
+		if (task_system->blocking_begin < tasks.size()) {
+
+			task = tasks[task_system->blocking_begin++];
+
+			if (task_system->blocking_begin == tasks.size()) {
+				tasks.reset();
+				task_system->blocking_begin = 0u;
+			}
+		}
+
+		return task;
+	}
+
+	SV_AUX Task* take_task(TaskThread& thread, bool take_blocking)
+	{
+		Task* task = queue_pop(thread.queue);
+		if (task) return task;
+
+		u32 count = task_system->thread_count;
+
+		if (count > 1u) {
+
+			thread.seed = thread.seed * 1103515245u + 12345u;
+			u32 begin = (thread.seed >> 16u) % count;
+
+			foreach(i, count) {
+
+				u32 index = (begin + i) % count;
+				if (index == thread.index) continue;
+
+				task = queue_steal(task_system->threads[index].queue);
+				if (task) return task;
+			}
+		}
+
+		if (take_blocking)
+			task = pop_blocking_task();
+
+		return task;
+	}
+
+	SV_AUX void execute_task(Task* task)
+	{
+		task->function();
+
+		ThreadContext* context = task->context;
+		task->function = nullptr;
+		task->context = NULL;
+		task->used.store(false, std::memory_order_release);
+
+		if (context) ThreadPool::finish_task(*context);
+	}
+
+	SV_AUX void wake_threads(u32 count)
+	{
+		// The task is published before reading the sleeping count, pairs with the fence in worker_main
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		
+		u32 sleeping = task_system->sleeping_count.load();
+
+		if (sleeping) {
+			semaphore_release(task_system->semaphore, SV_MIN(count, sleeping));
+		}
+	}
+
+	SV_INTERNAL void worker_main(void* data)
+	{
+		TaskThread& thread = *reinterpret_cast<TaskThread*>(data);
+		current_thread_index = thread.index;
+
+		while (task_system->running.load()) {
+
+			Task* task = NULL;
+
+			foreach(i, TASK_SPIN_COUNT) {
+
+				task = take_task(thread, true);
+				if (task) break;
+
+				thread_yield();
+			}
+
+			if (task == NULL) {
+
+				// Check again after notifying the sleep to avoid lost wakeups
+				task_system->sleeping_count.fetch_add(1u);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				task = take_task(thread, true);
+
+				if (task == NULL && task_system->running.load())
+					semaphore_wait(task_system->semaphore);
+
+				task_system->sleeping_count.fetch_sub(1u);
+			}
+
+			if (task) execute_task(task);
+		}
+	}
+
+	// Returns NULL if the ring is full of running tasks
+	SV_AUX Task* allocate_task(TaskThread& thread, const TaskFunction& function, ThreadContext* context)
+	{
+		Task* task = thread.pool + (thread.pool_index & TASK_QUEUE_MASK);
+
+		if (task->used.load(std::memory_order_acquire))
+			return NULL;
+
+		++thread.pool_index;
+
+		task->used.store(true, std::memory_order_relaxed);
+		task->function = function;
+		task->context = context;
+		return task;
+	}
+
+	// The other threads can't use the deques and the rings of the workers
+	SV_AUX bool submit_foreign_task(const TaskFunction& function, ThreadContext* context)
+	{
+		SV_LOCK_GUARD(task_system->blocking_mutex, lock);
+
+		Task* task = task_system->foreign_pool + (task_system->foreign_pool_index & (TASK_FOREIGN_POOL_SIZE - 1u));
+
+		if (task->used.load(std::memory_order_acquire))
+			return false;
+
+		++task_system->foreign_pool_index;
+
+		task->used.store(true, std::memory_order_relaxed);
+		task->function = function;
+		task->context = context;
+
+		task_system->blocking_tasks.push_back(task);
+		return true;
+	}
+
+	SV_AUX void submit_task(const TaskFunction& function, ThreadContext* context, bool blocking)
+	{
+		if (current_thread_index == u32_max) {
+
+			if (!submit_foreign_task(function, context)) {
+				
+				function();
+				if (context) ThreadPool::finish_task(*context);
+			}
+			return;
+		}
+		
+		TaskThread& thread = task_system->threads[current_thread_index];
+
+		Task* task = allocate_task(thread, function, context);
+
+		if (task) {
+
+			bool pushed;
+
+			if (blocking) {
+
+				SV_LOCK_GUARD(task_system->blocking_mutex, lock);
+				task_system->blocking_tasks.push_back(task);
+				pushed = true;
+			}
+			else pushed = queue_push(thread.queue, task);
+
+			if (pushed) return;
+
+			task->function = nullptr;
+			task->context = NULL;
+			task->used.store(false, std::memory_order_release);
+		}
+
+		// The queue is full, execute it here
+		function();
+		if (context) ThreadPool::finish_task(*context);
+	}
+
+	void task_execute(const TaskFunction& task, ThreadContext* context, bool blocking)
+	{
+		task_execute((TaskFunction*)&task, 1u, context, blocking);
+	}
+
+	void task_execute(TaskFunction* tasks, u32 count, ThreadContext* context, bool blocking)
+	{
+		if (count == 0u) return;
+
+		if (context) ThreadPool::add_tasks(*context, count);
+
+		if (task_system == NULL || task_system->thread_count <= 1u) {
+
+			foreach(i, count) {
+				tasks[i]();
+				if (context) ThreadPool::finish_task(*context);
+			}
+			return;
+		}
+
+		foreach(i, count) {
+			submit_task(tasks[i], context, blocking);
+		}
+
+		wake_threads(count);
+	}
+
+	void task_wait(const ThreadContext& context)
+	{
+		if (task_system == NULL) return;
+
+		// The foreign threads only help with the blocking tasks
+		if (current_thread_index == u32_max) {
+
+			while (ThreadPool::is_running(context)) {
+
+				Task* task = pop_blocking_task();
+
+				if (task) execute_task(task);
+				else thread_yield();
+			}
+			return;
+		}
+
+		TaskThread& thread = task_system->threads[current_thread_index];
+
+		// The main thread never executes blocking tasks
+		bool take_blocking = current_thread_index != 0u;
+
+		while (ThreadPool::is_running(context)) {
+
+			Task* task = take_task(thread, take_blocking);
+
+			if (task) execute_task(task);
+			else thread_yield();
+		}
+	}
+
+	bool task_running(const ThreadContext& context)
+	{
+		return ThreadPool::is_running(context);
+	}
+
+	u32 task_thread_count() noexcept
+	{
+		return task_system ? task_system->thread_count : 1u;
+	}
+
+	u32 task_thread_index() noexcept
+	{
+		return current_thread_index;
+	}
+
+	SV_AUX void graph_submit(TaskGraph& graph, u32 index);
+
+	SV_AUX void graph_execute_node(TaskGraph& graph, u32 index)
+	{
+		const TaskGraphNode& node = graph.nodes[index];
+
+		node.function();
+
+		foreach(i, node.successor_count) {
+
+			u32 successor = graph._successors[node.successor_begin + i];
+
+			// The last dependency submits the task
+			if (graph._pending[successor].fetch_sub(1u) == 1u)
+				graph_submit(graph, successor);
+		}
+	}
+
+	SV_AUX void graph_submit(TaskGraph& graph, u32 index)
+	{
+		TaskGraph* g = &graph;
+		task_execute([g, index]() { graph_execute_node(*g, index); }, &graph._context, graph.nodes[index].blocking);
+	}
+
+	u32 task_graph_add(TaskGraph& graph, const TaskFunction& task, bool blocking)
+	{
+		SV_ASSERT(!task_graph_running(graph));
+
+		TaskGraphNode& node = graph.nodes.emplace_back();
+		node.function = task;
+		node.dependency_count = 0u;
+		node.successor_begin = 0u;
+		node.successor_count = 0u;
+		node.blocking = blocking;
+
+		return u32(graph.nodes.size() - 1u);
+	}
+
+	void task_graph_depend(TaskGraph& graph, u32 task, u32 dependency)
+	{
+		SV_ASSERT(task < graph.nodes.size() && dependency < graph.nodes.size() && task != dependency);
+
+		TaskGraphEdge& edge = graph.edges.emplace_back();
+		edge.task = task;
+		edge.dependency = dependency;
+
+		++graph.nodes[task].dependency_count;
+	}
+
+	void task_graph_execute(TaskGraph& graph)
+	{
+		SV_ASSERT(!task_graph_running(graph));
+
+		u32 node_count = u32(graph.nodes.size());
+		if (node_count == 0u) return;
+
+		// Compute the successors of each task
+		{
+			for (TaskGraphNode& node : graph.nodes)
+				node.successor_count = 0u;
+
+			for (const TaskGraphEdge& edge : graph.edges)
+				++graph.nodes[edge.dependency].successor_count;
+
+			u32 offset = 0u;
+
+			for (TaskGraphNode& node : graph.nodes) {
+				node.successor_begin = offset;
+				offset += node.successor_count;
+				node.successor_count = 0u;
+			}
+
+			graph._successors.resize(graph.edges.size());
+
+			for (const TaskGraphEdge& edge : graph.edges) {
+
+				TaskGraphNode& node = graph.nodes[edge.dependency];
+				graph._successors[node.successor_begin + node.successor_count++] = edge.task;
+			}
+		}
+
+		if (graph._pending_count < node_count) {
+
+			if (graph._pending) SV_FREE_MEMORY(graph._pending);
+			graph._pending = (std::atomic<u32>*)SV_ALLOCATE_MEMORY(sizeof(std::atomic<u32>) * node_count, "TaskSystem");
+			graph._pending_count = node_count;
+		}
+
+		foreach(i, node_count) {
+			graph._pending[i].store(graph.nodes[i].dependency_count);
+		}
+
+		graph._context.Reset();
+
+		u32 root_count = 0u;
+
+		foreach(i, node_count) {
+
+			if (graph.nodes[i].dependency_count == 0u) {
+				graph_submit(graph, i);
+				++root_count;
+			}
+		}
+
+		if (root_count == 0u) {
+			SV_LOG_ERROR("The task graph has cyclic dependencies");
+		}
+	}
+
+	void task_graph_wait(TaskGraph& graph)
+	{
+		task_wait(graph._context);
+	}
+
+	bool task_graph_running(const TaskGraph& graph)
+	{
+		return task_running(graph._context);
+	}
+
+	void task_graph_clear(TaskGraph& graph)
+	{
+		SV_ASSERT(!task_graph_running(graph));
+
+		graph.nodes.clear();
+		graph.edges.clear();
+		graph._successors.clear();
+
+		if (graph._pending) {
+			SV_FREE_MEMORY(graph._pending);
+			graph._pending = nullptr;
+			graph._pending_count = 0u;
+		}
+	}
+
+	bool _task_initialize()
+	{
+		task_system = SV_ALLOCATE_STRUCT(TaskSystemState, "TaskSystem");
+
+		u32 thread_count = SV_MIN(SV_MAX(os_cpu_count(), 1u), TASK_THREAD_MAX);
+
+		SV_CHECK(semaphore_create(task_system->semaphore, 0u, u32(i32_max)));
+		SV_CHECK(mutex_create(task_system->blocking_mutex));
+
+		task_system->threads = (TaskThread*)SV_ALLOCATE_MEMORY(sizeof(TaskThread) * thread_count, "TaskSystem");
+		task_system->thread_count = thread_count;
+		task_system->thread_capacity = thread_count;
+		task_system->running.store(true);
+
+		foreach(i, thread_count) {
+
+			TaskThread& thread = *new(task_system->threads + i) TaskThread();
+			thread.index = i;
+			thread.seed = i * 7919u + 1u;
+		}
+
+		current_thread_index = 0u;
+
+		for (u32 i = 1u; i < thread_count; ++i) {
+
+			if (!thread_create(task_system->threads[i].thread, worker_main, task_system->threads + i)) {
+
+				SV_LOG_ERROR("Can't create the worker thread %u", i);
+				task_system->thread_count = i;
+				break;
+			}
+		}
+
+		SV_LOG_INFO("Task system initialized with %u threads", task_system->thread_count);
+
+		return true;
+	}
+
+	void _task_close()
+	{
+		if (task_system) {
+
+			task_system->running.store(false);
+			semaphore_release(task_system->semaphore, task_system->thread_count);
+
+			for (u32 i = 1u; i < task_system->thread_count; ++i) {
+				thread_wait(task_system->threads[i].thread);
+			}
+
+			// Execute the remaining tasks
+			{
+				TaskThread& thread = task_system->threads[0];
+				Task* task;
+
+				while ((task = take_task(thread, true)) != NULL)
+					execute_task(task);
+			}
+
+			semaphore_destroy(task_system->semaphore);
+			mutex_destroy(task_system->blocking_mutex);
+
+			SV_FREE_STRUCT_ARRAY(task_system->threads, task_system->thread_capacity);
+			SV_FREE_STRUCT(task_system);
+			task_system = NULL;
+		}
+	}
+
+}
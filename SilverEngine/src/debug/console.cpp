@@ -6,6 +6,7 @@
 
 #include "core/scene.h"
 #include "core/engine.h"
+#include "core/event_system.h"
 #include "core/renderer/renderer_internal.h"
 
 #include "platform/os.h"
@@ -32,6 +33,8 @@ namespace sv {
 		char* buff;
 		size_t buff_pos;
 		bool buff_flip;
+		// The logs can be written from the worker threads
+		Mutex buff_mutex;
 
 		char history[COMMAND_LINE_SIZE + 1u][HISTORY_COUNT] = {};
 		bool history_flip = false;
@@ -233,11 +236,373 @@ namespace sv {
 		return create_entity_model(parent, args[0]);
     }
 
+    static bool command_bench_components(const char** args, u32 argc) {
+
+		if (argc > 1u) {
+			SV_LOG_ERROR("Too much arguments");
+			return false;
+		}
+
+		if (!there_is_scene()) {
+			SV_LOG_ERROR("There is no scene");
+			return false;
+		}
+
+		i32 count = (argc == 1u) ? atoi(args[0]) : 1000000;
+
+		if (count <= 0) {
+			SV_LOG_ERROR("Invalid count");
+			return false;
+		}
+
+		CompID comp_id = get_component_id("Light");
+
+		List<Entity> entities;
+		entities.resize(count);
+
+		// The temporary entities aren't notified, the editor hierarchy would process each one
+		suspend_entity_events(true);
+
+		if (!create_entities(u32(count), 0, 0, entities.data())) {
+			suspend_entity_events(false);
+			SV_LOG_ERROR("Can't create the entities");
+			return false;
+		}
+
+		f64 t0 = timer_now();
+		
+		for (Entity e : entities) add_entity_component(e, comp_id);
+		
+		f64 t1 = timer_now();
+		
+		for (Entity e : entities) remove_entity_component(e, comp_id);
+		
+		f64 t2 = timer_now();
+		
+		// The second time the vacant slots are reused
+		for (Entity e : entities) add_entity_component(e, comp_id);
+		
+		f64 t3 = timer_now();
+
+		destroy_entities(entities.data(), u32(count));
+		suspend_entity_events(false);
+
+		SV_LOG("%d components\nCreate: %lf ms\nRemove: %lf ms\nReuse: %lf ms", count, (t1 - t0) * 1000.0, (t2 - t1) * 1000.0, (t3 - t2) * 1000.0);
+
+		return true;
+    }
+
+    static bool command_bench_transforms(const char** args, u32 argc) {
+
+		if (argc > 1u) {
+			SV_LOG_ERROR("Too much arguments");
+			return false;
+		}
+
+		i32 count = (argc == 1u) ? atoi(args[0]) : 1000000;
+
+		if (count <= 0) {
+			SV_LOG_ERROR("Invalid count");
+			return false;
+		}
+
+		u32 n = u32(count);
+
+		// Per entity layout
+		Transform* transforms = (Transform*)SV_ALLOCATE_MEMORY(sizeof(Transform) * n, "Console");
+		// Separated arrays
+		f32* streams = (f32*)SV_ALLOCATE_MEMORY(sizeof(f32) * 10u * n, "Console");
+		XMFLOAT4X4* matrices0 = (XMFLOAT4X4*)SV_ALLOCATE_MEMORY(sizeof(XMFLOAT4X4) * n, "Console");
+		XMFLOAT4X4* matrices1 = (XMFLOAT4X4*)SV_ALLOCATE_MEMORY(sizeof(XMFLOAT4X4) * n, "Console");
+
+		TransformStream stream = {
+			{ streams, streams + n, streams + n * 2u },
+			{ streams + n * 3u, streams + n * 4u, streams + n * 5u, streams + n * 6u },
+			{ streams + n * 7u, streams + n * 8u, streams + n * 9u }
+		};
+
+		foreach(i, n) {
+
+			Transform& t = transforms[i];
+			t.position = { math_random_f32(i * 3u) * 100.f, math_random_f32(i * 3u + 1u) * 100.f, math_random_f32(i * 3u + 2u) * 100.f };
+			t.scale = { 1.f + math_random_f32(i), 1.f, 2.f };
+
+			XMVECTOR q = XMQuaternionRotationRollPitchYaw(math_random_f32(i * 7u), math_random_f32(i * 11u), math_random_f32(i * 13u));
+			t.rotation = v4_f32(q);
+
+			streams[i] = t.position.x;
+			streams[n + i] = t.position.y;
+			streams[n * 2u + i] = t.position.z;
+			streams[n * 3u + i] = t.rotation.x;
+			streams[n * 4u + i] = t.rotation.y;
+			streams[n * 5u + i] = t.rotation.z;
+			streams[n * 6u + i] = t.rotation.w;
+			streams[n * 7u + i] = t.scale.x;
+			streams[n * 8u + i] = t.scale.y;
+			streams[n * 9u + i] = t.scale.z;
+		}
+
+		f64 t0 = timer_now();
+
+		foreach(i, n) {
+
+			const Transform& t = transforms[i];
+			XMMATRIX m = XMMatrixScalingFromVector(vec3_to_dx(t.scale)) * XMMatrixRotationQuaternion(vec4_to_dx(t.rotation))
+				* XMMatrixTranslation(t.position.x, t.position.y, t.position.z);
+			XMStoreFloat4x4(matrices0 + i, m);
+		}
+
+		f64 t1 = timer_now();
+
+		mat_compose_stream(stream, 0u, n, matrices1);
+
+		f64 t2 = timer_now();
+
+		f32 max_error = 0.f;
+		foreach(i, n) {
+
+			const f32* m0 = &matrices0[i]._11;
+			const f32* m1 = &matrices1[i]._11;
+
+			foreach(j, 16u) max_error = SV_MAX(max_error, abs(m0[j] - m1[j]));
+		}
+
+		SV_LOG("%u transforms\nPer entity: %lf ms\nStream: %lf ms\nMax error: %f", n, (t1 - t0) * 1000.0, (t2 - t1) * 1000.0, max_error);
+
+		SV_FREE_MEMORY(transforms);
+		SV_FREE_MEMORY(streams);
+		SV_FREE_MEMORY(matrices0);
+		SV_FREE_MEMORY(matrices1);
+
+		return true;
+    }
+
+	static SceneSnapshot* console_snapshot = NULL;
+
+	// The snapshot holds asset references, it can't live more than the scene
+	static void free_console_snapshot(CloseSceneEvent* e)
+	{
+		scene_snapshot_free(console_snapshot);
+		console_snapshot = NULL;
+	}
+
+    static bool command_snapshot(const char** args, u32 argc) {
+
+		if (argc) {
+			SV_LOG_ERROR("This command doesn't need arguments");
+			return false;
+		}
+
+		SceneSnapshot* snapshot = scene_snapshot_take();
+		if (snapshot == NULL) return false;
+
+		// The console is initialized before the event system
+		static bool registered = false;
+		if (!registered) {
+			event_register("close_scene", free_console_snapshot, 0u);
+			registered = true;
+		}
+
+		scene_snapshot_free(console_snapshot);
+		console_snapshot = snapshot;
+
+		SV_LOG("Snapshot taken");
+		return true;
+    }
+
+    static bool command_restore(const char** args, u32 argc) {
+
+		if (argc) {
+			SV_LOG_ERROR("This command doesn't need arguments");
+			return false;
+		}
+
+		if (console_snapshot == NULL) {
+			SV_LOG_ERROR("There is no snapshot");
+			return false;
+		}
+
+		if (!scene_snapshot_restore(console_snapshot)) {
+			SV_LOG_ERROR("Can't restore the snapshot");
+			return false;
+		}
+
+		SV_LOG("Snapshot restored");
+		return true;
+    }
+
+	// Compares the snapshots with the save and load of the scene, the scene is saved in a temporal file
+    static bool command_bench_snapshot(const char** args, u32 argc) {
+
+		if (argc) {
+			SV_LOG_ERROR("This command doesn't need arguments");
+			return false;
+		}
+
+		if (!there_is_scene()) {
+			SV_LOG_ERROR("There is no scene");
+			return false;
+		}
+
+		char name[SCENE_NAME_SIZE + 1u];
+		string_copy(name, get_scene_name(), SCENE_NAME_SIZE + 1u);
+
+		SceneSnapshot* original = scene_snapshot_take();
+		if (original == NULL) return false;
+
+		const char* filepath = "$system/cache/bench_snapshot.scene";
+
+		f64 t0 = timer_now();
+
+		bool res = save_scene(filepath);
+
+		f64 t1 = timer_now();
+
+		if (res) res = _start_scene(name, filepath);
+
+		f64 t2 = timer_now();
+
+		SceneSnapshot* snapshot = scene_snapshot_take();
+
+		f64 t3 = timer_now();
+
+		if (res) res = scene_snapshot_restore(original);
+
+		f64 t4 = timer_now();
+
+		scene_snapshot_free(snapshot);
+		scene_snapshot_free(original);
+
+		file_remove(filepath);
+		file_remove("$system/cache/bench_snapshot.scene.preload");
+
+		if (!res) {
+			SV_LOG_ERROR("The benchmark failed");
+			return false;
+		}
+
+		SV_LOG("Save: %lf ms\nLoad: %lf ms\nSnapshot take: %lf ms\nSnapshot restore: %lf ms", (t1 - t0) * 1000.0, (t2 - t1) * 1000.0, (t3 - t2) * 1000.0, (t4 - t3) * 1000.0);
+
+		return true;
+    }
+
+    static bool command_asset_timings(const char** args, u32 argc) {
+
+		if (argc != 0u) {
+			SV_LOG_ERROR("This command doesn't need arguments");
+			return false;
+		}
+
+		List<AssetLoadStats> stats;
+		get_asset_load_stats(stats);
+
+		for (const AssetLoadStats& s : stats) {
+
+			if (s.load_count == 0u) continue;
+
+			if (s.load_time != 0.0)
+				SV_LOG("%s: %u loaded, load %lf ms", s.name, s.load_count, s.load_time);
+			else
+				SV_LOG("%s: %u loaded, read %lf ms, decode %lf ms, upload %lf ms", s.name, s.load_count, s.read_time, s.decode_time, s.upload_time);
+		}
+
+		return true;
+    }
+
+    static bool command_asset_memory(const char** args, u32 argc) {
+
+		if (argc != 0u) {
+			SV_LOG_ERROR("This command doesn't need arguments");
+			return false;
+		}
+
+		List<AssetMemoryStats> stats;
+		AssetMemoryStats total;
+		get_asset_memory_stats(stats, &total);
+
+		stats.push_back(total);
+
+		for (const AssetMemoryStats& s : stats) {
+
+			SV_LOG("%s: %u assets, CPU %lf MB (budget %lf MB), GPU %lf MB (budget %lf MB)", s.name, s.asset_count,
+				   f64(s.cpu_bytes) / (1024.0 * 1024.0), f64(s.cpu_budget) / (1024.0 * 1024.0),
+				   f64(s.gpu_bytes) / (1024.0 * 1024.0), f64(s.gpu_budget) / (1024.0 * 1024.0));
+		}
+
+		return true;
+    }
+
+    static bool command_asset_budget(const char** args, u32 argc) {
+
+		if (argc != 3u) {
+			SV_LOG_ERROR("Use: asset_budget <type or global> <CPU MB> <GPU MB>, 0 means no limit");
+			return false;
+		}
+
+		u64 cpu = u64(atoi(args[1])) * 1024u * 1024u;
+		u64 gpu = u64(atoi(args[2])) * 1024u * 1024u;
+
+		if (string_equals(args[0], "global")) {
+			set_asset_global_budget(cpu, gpu);
+			return true;
+		}
+
+		return set_asset_budget(args[0], cpu, gpu);
+    }
+
+    static bool command_event_profile(const char** args, u32 argc) {
+
+		if (argc > 1u) {
+			SV_LOG_ERROR("Too much arguments");
+			return false;
+		}
+
+		if (argc == 1u) {
+
+			if (string_equals(args[0], "on")) {
+				event_profiling_enable(true);
+				SV_LOG("Event profiling enabled");
+			}
+			else if (string_equals(args[0], "off")) {
+				event_profiling_enable(false);
+				SV_LOG("Event profiling disabled");
+			}
+			else {
+				SV_LOG_ERROR("Invalid argument '%s', use on or off", args[0]);
+				return false;
+			}
+
+			return true;
+		}
+
+		if (!event_profiling_enabled()) {
+			SV_LOG_ERROR("The event profiling is disabled, use 'event_profile on'");
+			return false;
+		}
+
+		List<EventProfile> profiles;
+		event_profile_get(profiles);
+
+		for (const EventProfile& p : profiles) {
+
+			SV_LOG("%s: %u calls, %lf ms", p.name, p.calls, p.time);
+
+			for (const EventListenerProfile& l : p.listeners) {
+
+				if (l.plugin[0]) SV_LOG("    Plugin %s: %u calls, %lf ms", l.plugin, l.calls, l.time);
+				else SV_LOG("    %p: %u calls, %lf ms", l.function, l.calls, l.time);
+			}
+		}
+
+		return true;
+    }
+
     void _console_initialize()
     {
 		console.buff = (char*)SV_ALLOCATE_MEMORY(CONSOLE_SIZE, "Console");
 		console.buff_pos = 0U;
 		console.buff_flip = false;
+		mutex_create(console.buff_mutex);
 
 		// Register default commands
 	
@@ -252,6 +617,15 @@ namespace sv {
 		register_command("save_scene", command_save_scene);
 		register_command("clear_scene", command_clear_scene);
 		register_command("create_entity_model", command_create_entity_model);
+		register_command("bench_components", command_bench_components);
+		register_command("bench_transforms", command_bench_transforms);
+		register_command("snapshot", command_snapshot);
+		register_command("restore", command_restore);
+		register_command("bench_snapshot", command_bench_snapshot);
+		register_command("event_profile", command_event_profile);
+		register_command("asset_timings", command_asset_timings);
+		register_command("asset_memory", command_asset_memory);
+		register_command("asset_budget", command_asset_budget);
 	
 		//  Recive command history from last execution
 		{
@@ -294,6 +668,7 @@ namespace sv {
 
 		console.buff_pos = 0U;
 		console.buff_flip = false;
+		mutex_destroy(console.buff_mutex);
 
 		console.commands.clear();
 
@@ -447,8 +822,6 @@ namespace sv {
 
     void console_print(const char* str, ...)
     {
-		console.text_offset = 0.f;
-
 		va_list args;
 		va_start(args, str);
 
@@ -456,7 +829,11 @@ namespace sv {
 
 		vsnprintf(log_buffer, 1000, str, args);
 
-		_write(log_buffer, strlen(log_buffer));
+		{
+			SV_LOCK_GUARD(console.buff_mutex, lock);
+			console.text_offset = 0.f;
+			_write(log_buffer, strlen(log_buffer));
+		}
 		sv::print(log_buffer);
 
 		va_end(args);
@@ -464,8 +841,6 @@ namespace sv {
 
     void console_notify(const char* title, const char* str, ...)
     {
-		console.text_offset = 0.f;
-
 		va_list args;
 		va_start(args, str);
 
@@ -486,7 +861,11 @@ namespace sv {
 		log_buffer[end_pos] = '\n';
 		log_buffer[end_pos + 1u] = '\0';
 
-		_write(log_buffer, strlen(log_buffer));
+		{
+			SV_LOCK_GUARD(console.buff_mutex, lock);
+			console.text_offset = 0.f;
+			_write(log_buffer, strlen(log_buffer));
+		}
 		sv::print(log_buffer);
 
 		va_end(args);
@@ -494,6 +873,8 @@ namespace sv {
 
     void console_clear()
     {
+		SV_LOCK_GUARD(console.buff_mutex, lock);
+		
 		console.buff_pos = 0u;
 		console.buff_flip = false;
     }
@@ -600,6 +981,8 @@ namespace sv {
     {
 		if (!console.active && console.show_fade == 0.f) return;
 
+		SV_LOCK_GUARD(console.buff_mutex, lock);
+
 		CommandList cmd = graphics_commandlist_get();
 
 		// Flip console
@@ -180,8 +180,10 @@ namespace sv {
 		EntityHierarchyData entity_hierarchy_data;
 		SpriteSheetEditorData sprite_sheet_editor_data;
 		MaterialEditorData material_editor_data;
+		List<EventProfile> event_profiles;
 		ImportModelData import_model_data;
 		CreateTagData create_tag_data;
+		List<u8> component_copy;
 
 		char next_scene_name[SCENE_NAME_SIZE + 1u] = "";
     };
@@ -564,6 +566,33 @@ namespace sv {
 		}
 	}
 
+	static void parent_entity_element(EntityParentEvent* e)
+	{
+		auto& data = editor.entity_hierarchy_data;
+
+		HierarchyElement* parent_element = find_hierarchy_element_with_entity(data.root, e->entity, true);
+		if (parent_element == NULL) return;
+
+		HierarchyElement element;
+
+		foreach(i, parent_element->elements.size()) {
+
+			if (parent_element->elements[i].entity == e->entity) {
+
+				element = std::move(parent_element->elements[i]);
+				parent_element->elements.erase(i);
+				break;
+			}
+		}
+
+		HierarchyElement* new_parent_element = (e->parent == 0) ? &data.root : find_hierarchy_element_with_entity(data.root, e->parent, false);
+
+		if (new_parent_element) {
+			new_parent_element->elements.push_back(std::move(element));
+		}
+		else SV_ASSERT(0);
+	}
+
 	inline void create_editor_folder(HierarchyElement& parent, const char* name)
 	{
 		HierarchyElement& e = parent.elements.emplace_back();
@@ -1761,6 +1790,7 @@ namespace sv {
 		{
 			event_register("on_entity_create", create_entity_element, 0u);
 			event_register("on_entity_destroy", destroy_entity_element, 0u);
+			event_register("on_entity_parent", parent_entity_element, 0u);
 
 			event_register("pre_initialize_scene", load_hierarchy_state, 0u);
 			event_register("initialize_scene", validate_hierarchy, 0u);
@@ -2291,14 +2321,25 @@ namespace sv {
 					}
 				};
 
+				// Only the sprites whose bounds intersect with the ray are tested
+				List<Entity> candidates;
+				scene_query_ray(ray, candidates);
+
+				for (Entity entity : candidates) {
+
+					if (has_entity_component(entity, sprite_id) || has_entity_component(entity, textured_sprite_id) || has_entity_component(entity, animated_sprite_id))
+						sprite_intersect(entity);
+				}
+
+				// The mirrors aren't indexed, the sprites of the prefabs are tested with the world matrix of each instance
 				foreach_component(sprite_id, it, 0)
-					sprite_intersect(it.entity);
+					if (is_mirror(it.entity)) sprite_intersect(it.entity);
 				
 				foreach_component(textured_sprite_id, it, 0)
-					sprite_intersect(it.entity);
+					if (is_mirror(it.entity)) sprite_intersect(it.entity);
 				
 				foreach_component(animated_sprite_id, it, 0)
-					sprite_intersect(it.entity);
+					if (is_mirror(it.entity)) sprite_intersect(it.entity);
 			}
 		}
 		
@@ -2352,15 +2393,25 @@ namespace sv {
 
 					gui_push_id("Entity Components");
 
+					List<u8>& copy = editor.component_copy;
+
 					foreach(comp_index, comp_count) {
 
 						CompRef ref = get_entity_component_by_index(selected, comp_index);
 
+						// The component is compared with a copy to notify the changes of the widgets
+						u32 size = get_component_size(ref.comp_id);
+						copy.resize(size);
+						memcpy(copy.data(), ref.comp, size);
+
 						if (show_component_info(ref.comp_id, ref.comp)) {
 
 							remove_entity_component(selected, ref.comp_id);
 							comp_count = get_entity_component_count(selected);
 						}
+						else if (memcmp(copy.data(), ref.comp, size) != 0) {
+							mark_component_changed(selected, ref.comp_id);
+						}
 					}
 
 					gui_pop_id();
@@ -3405,6 +3456,44 @@ namespace sv {
 		}
 	}
 
+	SV_INTERNAL void display_event_profiler()
+	{
+		if (gui_begin_window("Event Profiler")) {
+
+			bool enabled = event_profiling_enabled();
+
+			if (gui_checkbox("Enabled", enabled))
+				event_profiling_enable(enabled);
+
+			if (enabled) {
+
+				List<EventProfile>& profiles = editor.event_profiles;
+				event_profile_get(profiles);
+
+				char text[200];
+				u64 id = 0u;
+
+				for (const EventProfile& p : profiles) {
+
+					gui_separator(1);
+
+					sprintf(text, "%s: %u calls, %.3f ms", p.name, p.calls, p.time);
+					gui_text(text, id++);
+					
+					for (const EventListenerProfile& l : p.listeners) {
+
+						if (l.plugin[0]) sprintf(text, "    Plugin %s: %u calls, %.3f ms", l.plugin, l.calls, l.time);
+						else sprintf(text, "    %p: %u calls, %.3f ms", l.function, l.calls, l.time);
+						
+						gui_text(text, id++);
+					}
+				}
+			}
+			
+			gui_end_window();
+		}
+	}
+
     SV_INTERNAL void display_gui()
     {
 		if (editor.debug_draw) {
@@ -3531,6 +3620,7 @@ namespace sv {
 							"Editor View",
 							"Game View",
 							"Renderer Debug",
+							"Event Profiler",
 						};
 
 						foreach(i, SV_ARRAY_SIZE(windows)) {
@@ -3575,6 +3665,7 @@ namespace sv {
 					display_scene_settings();
 					display_spritesheet_editor();
 					display_material_editor();
+					display_event_profiler();
 					gui_display_style_editor();
 
 					event_dispatch("display_gui", NULL);
@@ -15,9 +15,10 @@ namespace sv {
 		static v3_f32 rotation;
 		static v4_f32 last_quaternion;
 		
-		v3_f32& position = *get_entity_position_ptr(entity);
-		v4_f32& rotation_quat = *get_entity_rotation_ptr(entity);
-		v3_f32& scale = *get_entity_scale_ptr(entity);
+		// The transform is only written when it changes, writing the transform of a mirror creates an override
+		v3_f32 position = get_entity_position(entity);
+		v4_f32 rotation_quat = get_entity_rotation(entity);
+		v3_f32 scale = get_entity_scale(entity);
 
 		if (rotation_quat != last_quaternion) {
 			
@@ -26,12 +27,19 @@ namespace sv {
 
 		gui_push_id("ENTITY TRANSFORM");
 	
-		gui_drag_v3_f32(NULL, position, 0.05f, -f32_max, f32_max, 0u, GuiDragFlag_Position);
+		if (gui_drag_v3_f32(NULL, position, 0.05f, -f32_max, f32_max, 0u, GuiDragFlag_Position)) {
+
+			set_entity_position(entity, position);
+		}
 		if (gui_drag_v3_f32(NULL, rotation, 0.05f, -f32_max, f32_max, 1u, GuiDragFlag_Rotation)) {
 
 			rotation_quat = quaternion_from_euler_angles(rotation);
+			set_entity_rotation(entity, rotation_quat);
+		}
+		if (gui_drag_v3_f32(NULL, scale, 0.05f, -f32_max, f32_max, 2u, GuiDragFlag_Scale)) {
+
+			set_entity_scale(entity, scale);
 		}
-		gui_drag_v3_f32(NULL, scale, 0.05f, -f32_max, f32_max, 2u, GuiDragFlag_Scale);
 
 		last_quaternion = rotation_quat;
 	
@@ -0,0 +1,175 @@
+#include "platform/os.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "core/engine.h"
+
+// Only the file watcher, the rest of the linux platform layer doesn't exist yet
+
+namespace sv {
+
+    constexpr u32 FILE_WATCHER_BUFFER_SIZE = 32u * 1024u;
+    constexpr u32 FILE_WATCHER_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+    struct FileWatch {
+		int  wd;
+		char folderpath[FILEPATH_SIZE + 1u];
+    };
+
+    struct FileWatcher {
+		int             fd;
+		// inotify watches only one folder, the subfolders are added one by one
+		List<FileWatch> watches;
+		alignas(inotify_event) char buffer[FILE_WATCHER_BUFFER_SIZE];
+		u32             offset;
+		u32             size;
+		bool            lost_changes;
+		bool            valid;
+    };
+
+    SV_AUX void file_watcher_add_folder(FileWatcher* watcher, const char* folderpath_)
+    {
+		char folderpath[FILEPATH_SIZE + 1u];
+		filepath_resolve(folderpath, folderpath_);
+
+		int wd = inotify_add_watch(watcher->fd, folderpath, FILE_WATCHER_MASK);
+		if (wd < 0) {
+			SV_LOG_ERROR("Can't watch the folder '%s'", folderpath_);
+			return;
+		}
+
+		FileWatch& watch = watcher->watches.emplace_back();
+		watch.wd = wd;
+		string_copy(watch.folderpath, folderpath_, FILEPATH_SIZE + 1u);
+
+		DIR* dir = opendir(folderpath);
+		if (dir == NULL) return;
+
+		while (dirent* entry = readdir(dir)) {
+
+			if (entry->d_type != DT_DIR || string_equals(entry->d_name, ".") || string_equals(entry->d_name, ".."))
+				continue;
+
+			char subfolder[FILEPATH_SIZE + 1u];
+			string_copy(subfolder, folderpath_, FILEPATH_SIZE + 1u);
+			string_append(subfolder, "/", FILEPATH_SIZE + 1u);
+			string_append(subfolder, entry->d_name, FILEPATH_SIZE + 1u);
+
+			file_watcher_add_folder(watcher, subfolder);
+		}
+
+		closedir(dir);
+    }
+
+    FileWatcher* file_watcher_create(const char* folderpath)
+    {
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (fd < 0) {
+			SV_LOG_ERROR("Can't initialize inotify");
+			return NULL;
+		}
+
+		FileWatcher* watcher = SV_ALLOCATE_STRUCT(FileWatcher, "Platform");
+		watcher->fd = fd;
+		watcher->offset = 0u;
+		watcher->size = 0u;
+		watcher->lost_changes = false;
+		watcher->valid = true;
+
+		file_watcher_add_folder(watcher, folderpath);
+
+		if (watcher->watches.empty()) {
+			file_watcher_destroy(watcher);
+			return NULL;
+		}
+
+		return watcher;
+    }
+
+    void file_watcher_destroy(FileWatcher* watcher)
+    {
+		if (watcher == NULL) return;
+
+		close(watcher->fd);
+		SV_FREE_STRUCT(watcher);
+    }
+
+    bool file_watcher_next(FileWatcher* watcher, char* filepath)
+    {
+		while (true) {
+
+			while (watcher->offset < watcher->size) {
+
+				inotify_event* event = reinterpret_cast<inotify_event*>(watcher->buffer + watcher->offset);
+				watcher->offset += u32(sizeof(inotify_event) + event->len);
+
+				// The kernel queue is full, the changes are lost
+				if (event->mask & IN_Q_OVERFLOW) {
+					watcher->lost_changes = true;
+					continue;
+				}
+
+				if (event->len == 0u) continue;
+
+				const FileWatch* watch = NULL;
+
+				for (const FileWatch& w : watcher->watches) {
+					if (w.wd == event->wd) {
+						watch = &w;
+						break;
+					}
+				}
+
+				if (watch == NULL) continue;
+
+				string_copy(filepath, watch->folderpath, FILEPATH_SIZE + 1u);
+				string_append(filepath, "/", FILEPATH_SIZE + 1u);
+				string_append(filepath, event->name, FILEPATH_SIZE + 1u);
+
+				if (event->mask & IN_ISDIR) {
+
+					// New subfolder, the files created before the watch aren't notified
+					if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+						file_watcher_add_folder(watcher, filepath);
+						watcher->lost_changes = true;
+					}
+					continue;
+				}
+
+				// The files are notified when are closed, not when are created
+				if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+					return true;
+			}
+
+			ssize_t bytes = read(watcher->fd, watcher->buffer, FILE_WATCHER_BUFFER_SIZE);
+
+			// EAGAIN: No more changes
+			if (bytes <= 0) {
+
+				if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+					watcher->valid = false;
+				return false;
+			}
+
+			watcher->offset = 0u;
+			watcher->size = u32(bytes);
+		}
+    }
+
+    bool file_watcher_lost_changes(FileWatcher* watcher)
+    {
+		bool lost = watcher->lost_changes;
+		watcher->lost_changes = false;
+		return lost;
+    }
+
+    bool file_watcher_valid(FileWatcher* watcher)
+    {
+		return watcher->valid;
+    }
+
+}
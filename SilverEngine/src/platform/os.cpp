@@ -30,6 +30,20 @@ namespace sv {
 		return true;
     }
 
+    bool load_image_from_memory(const void* src, size_t size, void** pdata, u32* width, u32* height)
+    {
+		int w = 0, h = 0, bits = 0;
+		void* data = stbi_load_from_memory((const stbi_uc*)src, (int)size, &w, &h, &bits, 4);
+
+		*pdata = nullptr;
+		*width = w;
+		*height = h;
+
+		if (!data) return false;
+		*pdata = data;
+		return true;
+    }
+
     // TODO: Platform specific!!
 
     ///////////////////////////////////////////////// TIMER /////////////////////////////////////////////////
@@ -909,6 +909,151 @@ namespace sv {
 		FindClose(find);
     }
 
+    constexpr u32 FILE_WATCHER_BUFFER_SIZE = 32u * 1024u;
+
+    struct FileWatcher {
+		HANDLE     directory;
+		OVERLAPPED overlapped;
+		char       folderpath[FILEPATH_SIZE + 1u];
+		// The notifications are copied to be processed while the next read is pending
+		DWORD      buffer[FILE_WATCHER_BUFFER_SIZE / sizeof(DWORD)];
+		DWORD      notifications[FILE_WATCHER_BUFFER_SIZE / sizeof(DWORD)];
+		u32        offset;
+		u32        size;
+		bool       reading;
+		bool       lost_changes;
+		bool       valid;
+    };
+
+    SV_AUX bool file_watcher_read(FileWatcher* watcher)
+    {
+		BOOL res = ReadDirectoryChangesW(watcher->directory, watcher->buffer, FILE_WATCHER_BUFFER_SIZE, TRUE,
+										 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+										 NULL, &watcher->overlapped, NULL);
+		watcher->reading = res != 0;
+		return watcher->reading;
+    }
+    
+    FileWatcher* file_watcher_create(const char* folderpath_)
+    {
+		char folderpath[MAX_PATH];
+		filepath_resolve(folderpath, folderpath_);
+
+		HANDLE directory = CreateFileA(folderpath, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+									   NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+
+		if (directory == INVALID_HANDLE_VALUE) {
+			SV_LOG_ERROR("Can't watch the folder '%s'", folderpath_);
+			return NULL;
+		}
+
+		FileWatcher* watcher = SV_ALLOCATE_STRUCT(FileWatcher, "Platform");
+		watcher->directory = directory;
+		SV_ZERO_MEMORY(&watcher->overlapped, sizeof(OVERLAPPED));
+		watcher->overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+		string_copy(watcher->folderpath, folderpath_, FILEPATH_SIZE + 1u);
+		watcher->offset = 0u;
+		watcher->size = 0u;
+		watcher->lost_changes = false;
+		watcher->valid = true;
+
+		if (!file_watcher_read(watcher)) {
+			SV_LOG_ERROR("Can't watch the folder '%s'", folderpath_);
+			file_watcher_destroy(watcher);
+			return NULL;
+		}
+
+		return watcher;
+    }
+
+    void file_watcher_destroy(FileWatcher* watcher)
+    {
+		if (watcher == NULL) return;
+
+		if (watcher->reading) {
+			
+			DWORD bytes;
+			CancelIo(watcher->directory);
+			GetOverlappedResult(watcher->directory, &watcher->overlapped, &bytes, TRUE);
+		}
+
+		CloseHandle(watcher->overlapped.hEvent);
+		CloseHandle(watcher->directory);
+		SV_FREE_STRUCT(watcher);
+    }
+
+    bool file_watcher_next(FileWatcher* watcher, char* filepath)
+    {
+		while (true) {
+
+			while (watcher->offset < watcher->size) {
+
+				FILE_NOTIFY_INFORMATION* info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(reinterpret_cast<u8*>(watcher->notifications) + watcher->offset);
+				
+				watcher->offset = info->NextEntryOffset ? (watcher->offset + info->NextEntryOffset) : watcher->size;
+
+				if (info->Action == FILE_ACTION_REMOVED || info->Action == FILE_ACTION_RENAMED_OLD_NAME)
+					continue;
+
+				char name[FILEPATH_SIZE + 1u];
+				int size = WideCharToMultiByte(CP_UTF8, 0, info->FileName, int(info->FileNameLength / sizeof(WCHAR)), name, FILEPATH_SIZE, NULL, NULL);
+				if (size <= 0) continue;
+				name[size] = '\0';
+
+				string_copy(filepath, watcher->folderpath, FILEPATH_SIZE + 1u);
+				string_append(filepath, "/", FILEPATH_SIZE + 1u);
+				string_append(filepath, name, FILEPATH_SIZE + 1u);
+
+				for (char* it = filepath; *it; ++it)
+					if (*it == '\\') *it = '/';
+
+				return true;
+			}
+
+			// The read can't be started, the changes since the last read are lost. If it fails again the folder can't be watched
+			if (!watcher->reading) {
+
+				watcher->lost_changes = true;
+				watcher->valid = watcher->valid && file_watcher_read(watcher);
+				return false;
+			}
+
+			DWORD bytes;
+			if (!GetOverlappedResult(watcher->directory, &watcher->overlapped, &bytes, FALSE)) {
+
+				if (GetLastError() == ERROR_IO_INCOMPLETE)
+					return false;
+
+				// The read failed, is started again
+				ResetEvent(watcher->overlapped.hEvent);
+				watcher->reading = false;
+				continue;
+			}
+
+			// 0 bytes means that the buffer overflowed, the changes are lost
+			if (bytes == 0u) watcher->lost_changes = true;
+			
+			memcpy(watcher->notifications, watcher->buffer, bytes);
+			watcher->offset = 0u;
+			watcher->size = u32(bytes);
+
+			ResetEvent(watcher->overlapped.hEvent);
+			file_watcher_read(watcher);
+		}
+    }
+
+    bool file_watcher_lost_changes(FileWatcher* watcher)
+    {
+		bool lost = watcher->lost_changes;
+		watcher->lost_changes = false;
+		return lost;
+    }
+
+    bool file_watcher_valid(FileWatcher* watcher)
+    {
+		return watcher->valid;
+    }
+
     constexpr u32 BIN_PATH_SIZE = 100u;
     
     SV_AUX void bin_filepath(char* buf, u64 hash, bool system)
@@ -974,6 +1119,86 @@ namespace sv {
 		ReleaseMutex((HANDLE)mutex._handle);
     }
 
+	bool semaphore_create(Semaphore& semaphore, u32 initial_count, u32 max_count)
+	{
+		semaphore._handle = (u64)CreateSemaphoreA(NULL, (LONG)initial_count, (LONG)max_count, NULL);
+		return semaphore._handle != NULL;
+	}
+
+	void semaphore_destroy(Semaphore semaphore)
+	{
+		if (semaphore._handle != NULL) {
+			CloseHandle((HANDLE)semaphore._handle);
+		}
+	}
+
+	void semaphore_wait(Semaphore semaphore)
+	{
+		SV_ASSERT(semaphore._handle != 0u);
+		WaitForSingleObject((HANDLE)semaphore._handle, INFINITE);
+	}
+
+	void semaphore_release(Semaphore semaphore, u32 count)
+	{
+		SV_ASSERT(semaphore._handle != 0u);
+		ReleaseSemaphore((HANDLE)semaphore._handle, (LONG)count, NULL);
+	}
+
+	struct ThreadStart {
+		ThreadMainFn main_fn;
+		void* data;
+	};
+
+	SV_INTERNAL DWORD WINAPI thread_main(LPVOID param)
+	{
+		ThreadStart start = *reinterpret_cast<ThreadStart*>(param);
+		SV_FREE_MEMORY(param);
+
+		start.main_fn(start.data);
+		return 0;
+	}
+
+	bool thread_create(Thread& thread, ThreadMainFn main_fn, void* data)
+	{
+		ThreadStart* start = (ThreadStart*)SV_ALLOCATE_MEMORY(sizeof(ThreadStart), "OS");
+		start->main_fn = main_fn;
+		start->data = data;
+
+		thread._handle = (u64)CreateThread(NULL, 0u, thread_main, start, 0u, NULL);
+
+		if (thread._handle == NULL) {
+			SV_FREE_MEMORY(start);
+			return false;
+		}
+
+		return true;
+	}
+
+	void thread_wait(Thread thread)
+	{
+		if (thread._handle != NULL) {
+			WaitForSingleObject((HANDLE)thread._handle, INFINITE);
+			CloseHandle((HANDLE)thread._handle);
+		}
+	}
+
+	void thread_yield()
+	{
+		SwitchToThread();
+	}
+
+	void thread_sleep(u32 millis)
+	{
+		Sleep((DWORD)millis);
+	}
+
+	u32 os_cpu_count()
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return (u32)info.dwNumberOfProcessors;
+	}
+
 	// DYNAMIC LIBRARIES
 
 	Library library_load(const char* filepath_)
@@ -3,7 +3,7 @@
 #if SV_PLATFORM_WIN
 #include "platform/win64.cpp"
 #elif SV_PLATFORM_LINUX
-
+#include "platform/linux.cpp"
 #endif
 
 #include "platform/os.cpp"
@@ -162,10 +162,8 @@ namespace sv {
 
     //////////////////////////////////// DESERIALIZER /////////////////
 
-    bool deserialize_begin(Deserializer& d, const char* filepath)
+    SV_AUX bool deserialize_begin_buffer(Deserializer& d)
     {
-		SV_CHECK(file_read_binary(filepath, d.buff));
-	
 		d.pos = 0u;
 
 		SV_CHECK(deserialize_assert(d, sizeof(Version) + sizeof(u32)));
@@ -180,6 +178,19 @@ namespace sv {
 
 		return true;
     }
+
+    bool deserialize_begin(Deserializer& d, const char* filepath)
+    {
+		SV_CHECK(file_read_binary(filepath, d.buff));
+		return deserialize_begin_buffer(d);
+    }
+
+    bool deserialize_begin(Deserializer& d, const void* data, size_t size)
+    {
+		d.buff.clear();
+		d.buff.write_back(data, size);
+		return deserialize_begin_buffer(d);
+    }
     
     void deserialize_end(Deserializer& d)
     {